@@ -0,0 +1,109 @@
+// Per-token sampling cost: llama.cpp's top_k -> top_p -> temp -> dist
+// chain against FusedSampler, over random logits at common vocab sizes.
+//
+//   sampler_bench [iterations]
+
+#include "llm/fused_sampler.h"
+#include "llama.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+static constexpr int TOP_K = 40;
+static constexpr float TOP_P = 0.9f;
+static constexpr float TEMPERATURE = 0.7f;
+static constexpr uint32_t SEED = 1234;
+
+template <typename F>
+static double us_per_call(int iterations, F &&fn)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; ++i)
+		fn(i);
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	return std::chrono::duration<double, std::micro>(elapsed).count() / iterations;
+}
+
+int main(int argc, char **argv)
+{
+	int iterations = argc > 1 ? std::atoi(argv[1]) : 200;
+	if (iterations <= 0)
+		iterations = 200;
+
+	// Llama 2, GPT-2, Llama 3, Qwen 2, Gemma
+	const int vocab_sizes[] = {32000, 50257, 128256, 151936, 256000};
+
+	std::printf("%-8s %12s %12s %12s %9s\n", "n_vocab", "chain us", "fused us", "fused+arr us", "speedup");
+
+	for (int n_vocab : vocab_sizes)
+	{
+		// A few rows of logits shaped roughly like a model's: mostly noise,
+		// a handful of clear favourites
+		const int n_rows = 8;
+		std::mt19937 gen(SEED);
+		std::normal_distribution<float> noise(0.0f, 2.0f);
+		std::uniform_int_distribution<int> pick(0, n_vocab - 1);
+
+		std::vector<std::vector<float>> rows(n_rows, std::vector<float>(n_vocab));
+		for (auto &row : rows)
+		{
+			for (auto &logit : row)
+				logit = noise(gen);
+			for (int i = 0; i < 10; ++i)
+				row[pick(gen)] += 10.0f;
+		}
+
+		std::vector<llama_token_data> candidates(n_vocab);
+		auto fill = [&](const std::vector<float> &row)
+		{
+			for (int i = 0; i < n_vocab; ++i)
+				candidates[i] = llama_token_data{i, row[i], 0.0f};
+			return llama_token_data_array{candidates.data(), candidates.size(), -1, false};
+		};
+
+		llama_sampler *chain = llama_sampler_chain_init(llama_sampler_chain_default_params());
+		llama_sampler_chain_add(chain, llama_sampler_init_top_k(TOP_K));
+		llama_sampler_chain_add(chain, llama_sampler_init_top_p(TOP_P, 1));
+		llama_sampler_chain_add(chain, llama_sampler_init_temp(TEMPERATURE));
+		llama_sampler_chain_add(chain, llama_sampler_init_dist(SEED));
+
+		SamplingParams params;
+		params.temperature = TEMPERATURE;
+		params.top_k = TOP_K;
+		params.top_p = TOP_P;
+		params.repeat_penalty = 1.0f;
+		params.seed = SEED;
+		FusedSampler fused(n_vocab, params);
+
+		// The result is summed so the calls cannot be optimized away
+		long long sink = 0;
+
+		double chain_us = us_per_call(iterations, [&](int i)
+																	{
+			llama_token_data_array cur = fill(rows[i % n_rows]);
+			llama_sampler_apply(chain, &cur);
+			sink += cur.data[cur.selected].id; });
+
+		double fused_us = us_per_call(iterations, [&](int i)
+																	{ sink += fused.sample(rows[i % n_rows].data()); });
+
+		// As used behind a grammar, when the candidate array already exists
+		double fused_array_us = us_per_call(iterations, [&](int i)
+																				{
+			llama_token_data_array cur = fill(rows[i % n_rows]);
+			fused.apply(&cur);
+			sink += cur.data[cur.selected].id; });
+
+		llama_sampler_free(chain);
+
+		std::printf("%-8d %12.1f %12.1f %12.1f %8.1fx\n",
+								n_vocab, chain_us, fused_us, fused_array_us, chain_us / fused_us);
+
+		if (sink == -1)
+			std::printf("\n");
+	}
+
+	return 0;
+}
@@ -1,10 +1,18 @@
 #pragma once
 
 #include <nlohmann/json.hpp>
+#include "core/metrics.h"
+#include "core/thread_pool.h"
+#include "core/tool_executor.h"
 #include "core/tool_registry.h"
 #include "llm/llama_engine.h"
-#include <future>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
 
 using json = nlohmann::json;
 
@@ -12,29 +20,86 @@ struct ToolTask
 {
 	std::string call_id;
 	std::string tool;
-	std::future<json> future;
+	ToolFuture future;
 };
 
+// Delivers an intermediate frame (e.g. a streamed token) to the client
+// ahead of the final response. Returns false once the client is gone.
+using FrameSink = std::function<bool(const json &frame)>;
+
 class ActionDispatcher
 {
 public:
-	ActionDispatcher(ToolRegistry &registry, std::shared_ptr<LlamaEngine> llm_engine);
+	// Tool calls run on tool_executor, which must outlive the dispatcher
+	ActionDispatcher(ToolRegistry &registry, std::shared_ptr<LlamaEngine> llm_engine, ToolExecutor &tool_executor);
+	~ActionDispatcher();
+
+	// Disable copy
+	ActionDispatcher(const ActionDispatcher &) = delete;
+	ActionDispatcher &operator=(const ActionDispatcher &) = delete;
+
+	// emit is only used by actions that stream ("stream": true). A request
+	// "id" is echoed on the response and on every streamed frame so
+	// pipelined responses can be matched up.
+	json dispatch(const json &request, const FrameSink &emit = nullptr);
+
+	// True for actions that may block on the LLM or on tools and should
+	// run on a worker thread instead of the IPC event loop.
+	bool is_long_running(const json &request) const;
+
+	// Prefill the system prompt and tool manifest that every infer request
+	// starts with. Call once before serving.
+	void warm_up();
+
+	// Pool whose queue depth the metrics report; nullptr detaches it
+	void set_worker_pool(const ThreadPool *pool);
+
+	// Rewrite path with the Prometheus text of the metrics every few
+	// seconds, for a node_exporter textfile collector or similar
+	void start_metrics_dump(const std::string &path);
 
-	json dispatch(const json &request);
+	// Request, tool and generation metrics, as JSON or Prometheus text
+	json metrics_json();
+	std::string metrics_text();
 
 private:
 	ToolRegistry &tool_registry_;
 	std::shared_ptr<LlamaEngine> llm_engine_;
+	ToolExecutor &tool_executor_;
+
+	// Constrains infer output to an answer or valid tool calls
+	std::string tool_grammar_;
+
+	// Names the private sessions of infer requests that bring none
+	std::atomic<uint64_t> next_agent_session_{0};
+
+	// One entry per action, plus "unknown", all made by the constructor so
+	// dispatch() finds them without a lock
+	std::map<std::string, CallStats> action_stats_;
+	std::atomic<int> requests_in_flight_{0};
+
+	std::mutex pool_mutex_;
+	const ThreadPool *worker_pool_ = nullptr;
+
+	std::thread dump_thread_;
+	std::mutex dump_mutex_;
+	std::condition_variable dump_cv_;
+	bool dump_stopping_ = false;
 
 	ToolTask submit_tool_call(const json &call);
 
+	json route(const json &request, const FrameSink &emit);
+	json timed_route(const json &request, const FrameSink &emit);
+
 	json handle_ping(const json &request);
 	json handle_infer(const json &request);
 	json handle_list_tools(const json &request);
-	json handle_generate(const json &request);
+	json handle_generate(const json &request, const FrameSink &emit);
 	json handle_model_info(const json &request);
+	json handle_metrics(const json &request);
 
 	// Helper for AI-powered tool calling
 	json infer_with_ai(const json &request);
-	bool is_tool_call_response(const std::string &text, json &parsed);
+	json tool_system_message() const;
+	bool parse_tool_calls(const std::string &text, std::vector<json> &calls);
 };
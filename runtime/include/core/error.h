@@ -10,6 +10,7 @@ enum class ErrorCode
 	INVALID_ARGUMENT,
 	UNKNOWN_TOOL,
 	TOOL_EXECUTION_FAILED,
+	TOOL_TIMEOUT,
 	INTERNAL_ERROR
 };
 
@@ -25,6 +26,8 @@ inline std::string to_string(ErrorCode code)
 		return "UNKNOWN_TOOL";
 	case ErrorCode::TOOL_EXECUTION_FAILED:
 		return "TOOL_EXECUTION_FAILED";
+	case ErrorCode::TOOL_TIMEOUT:
+		return "TOOL_TIMEOUT";
 	default:
 		return "INTERNAL_ERROR";
 	}
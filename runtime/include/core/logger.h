@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+
+enum class LogLevel : int
+{
+	DEBUG,
+	INFO,
+	WARN,
+	ERROR,
+	OFF
+};
+
+// Parses debug, info, warn, error or off; false if name is none of them
+bool parse_log_level(const std::string &name, LogLevel &level);
+
+// Small, stable number of the calling thread, shared by log records and
+// traces
+uint32_t thread_number();
+
+// Process-wide logger. Callers format a record and push it onto a
+// bounded lock-free ring; a background thread writes batches of them to
+// stderr or a file. A full ring drops records, counted and reported,
+// rather than stall the caller. Use the LOG_* macros, which skip the
+// formatting entirely when the level is disabled.
+class Logger
+{
+public:
+	static Logger &instance();
+
+	~Logger();
+
+	// Disable copy
+	Logger(const Logger &) = delete;
+	Logger &operator=(const Logger &) = delete;
+
+	// path empty: stderr. json: one JSON object per line instead of text.
+	// Returns false if path cannot be opened; stderr is kept then.
+	bool configure(LogLevel level, const std::string &path, bool json, size_t body_bytes);
+
+	bool enabled(LogLevel level) const
+	{
+		return static_cast<int>(level) >= level_.load(std::memory_order_relaxed);
+	}
+
+	void write(LogLevel level, const char *component, std::string message);
+
+	// At most body_bytes of a request or response body, with the full size
+	// noted when it was cut
+	std::string excerpt(std::string_view body) const;
+
+	// Blocks until everything logged so far is written
+	void flush();
+
+private:
+	struct Record
+	{
+		LogLevel level = LogLevel::INFO;
+		const char *component = "";
+		uint32_t thread = 0;
+		std::chrono::system_clock::time_point time;
+		std::string message;
+	};
+
+	// Bounded multi-producer, single-consumer queue (after Vyukov): each
+	// cell's sequence number says whose turn it is, so producers only race
+	// on one compare-exchange of head_
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		Record record;
+	};
+
+	static constexpr size_t CAPACITY = 8192; // power of two
+
+	std::unique_ptr<Cell[]> cells_;
+	alignas(64) std::atomic<size_t> head_;
+	alignas(64) size_t tail_; // writer thread only
+	std::atomic<uint64_t> dropped_;
+	std::atomic<uint64_t> pushed_;
+	std::atomic<uint64_t> written_;
+
+	std::atomic<int> level_;
+	std::atomic<size_t> body_bytes_;
+
+	std::mutex sink_mutex_; // guards out_ and json_ against configure()
+	FILE *out_;
+	bool json_;
+
+	std::mutex wake_mutex_;
+	std::condition_variable wake_cv_;
+	std::condition_variable flushed_cv_;
+	bool stopping_;
+	std::thread writer_;
+
+	Logger();
+
+	bool pop(Record &record);
+	void writer_loop();
+	void format(const Record &record, std::string &out) const;
+};
+
+#define LOG_AT(level, component, message)                          \
+	do                                                               \
+	{                                                                \
+		if (Logger::instance().enabled(level))                         \
+		{                                                              \
+			std::ostringstream log_stream_;                              \
+			log_stream_ << message;                                      \
+			Logger::instance().write(level, component, log_stream_.str()); \
+		}                                                              \
+	} while (0)
+
+#define LOG_DEBUG(component, message) LOG_AT(LogLevel::DEBUG, component, message)
+#define LOG_INFO(component, message) LOG_AT(LogLevel::INFO, component, message)
+#define LOG_WARN(component, message) LOG_AT(LogLevel::WARN, component, message)
+#define LOG_ERROR(component, message) LOG_AT(LogLevel::ERROR, component, message)
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include "llm/generation_stats.h"
+
+// LatencyHistogram's buckets as relaxed atomic counters, so any thread
+// can record without taking a lock; readers take a snapshot
+class AtomicHistogram
+{
+public:
+	void add(float ms);
+	LatencyHistogram snapshot() const;
+
+private:
+	std::array<std::atomic<uint64_t>, LatencyHistogram::N_BUCKETS> buckets_{};
+	std::atomic<uint64_t> sum_us_{0};
+};
+
+// Calls, failures and latency of one action or tool. Instances are
+// created before serving starts and never move, so recording is a few
+// atomic increments.
+struct CallStats
+{
+	std::atomic<uint64_t> calls{0};
+	std::atomic<uint64_t> errors{0};
+	AtomicHistogram latency;
+
+	void record(float ms, bool ok);
+};
+
+// Writes the Prometheus text exposition format (version 0.0.4)
+class Prometheus
+{
+public:
+	// "# HELP" and "# TYPE" lines
+	static void header(std::ostream &out, const std::string &name, const std::string &type, const std::string &help);
+
+	// name{labels} value; labels is empty or e.g. action="infer"
+	static void sample(std::ostream &out, const std::string &name, const std::string &labels, double value);
+
+	// Cumulative _bucket series in seconds at every doubling, then _sum
+	// and _count
+	static void histogram(std::ostream &out, const std::string &name, const std::string &labels, const LatencyHistogram &ms);
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool of worker threads fed from a single FIFO queue.
+// Used by the IPC layer to run long actions (generate, infer) off the
+// event loop.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(size_t n_threads);
+	~ThreadPool();
+
+	// Disable copy
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	void submit(std::function<void()> task);
+
+	size_t size() const { return workers_.size(); }
+	size_t pending() const;
+
+private:
+	std::vector<std::thread> workers_;
+	std::deque<std::function<void()>> queue_;
+	mutable std::mutex mutex_;
+	std::condition_variable cv_;
+	bool stopping_;
+
+	void worker_loop();
+};
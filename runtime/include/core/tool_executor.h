@@ -0,0 +1,151 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+// Result of a call submitted to a ToolExecutor: one shared state, set once
+class ToolFuture
+{
+public:
+	ToolFuture() = default;
+
+	bool valid() const { return state_ != nullptr; }
+
+	// Blocks until the call finished or its deadline passed, then returns
+	// its result or rethrows what it threw. Past the deadline it returns a
+	// TOOL_TIMEOUT error, and a call still queued is never run.
+	json get();
+
+private:
+	friend class ToolExecutor;
+
+	struct State
+	{
+		std::mutex mutex;
+		std::condition_variable cv;
+		bool done = false;
+		bool abandoned = false; // the caller gave up waiting
+		json result;
+		std::exception_ptr error;
+		std::string tool;
+		std::chrono::milliseconds timeout{0};
+		std::chrono::steady_clock::time_point deadline; // max(): none
+		std::atomic<uint64_t> *timeouts = nullptr;
+
+		bool is_abandoned()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return abandoned;
+		}
+	};
+
+	std::shared_ptr<State> state_;
+
+	explicit ToolFuture(std::shared_ptr<State> state) : state_(std::move(state)) {}
+};
+
+// Shared, bounded pool that runs tool calls. Each worker owns a queue;
+// submissions are spread over them and an idle worker steals from the
+// others, so one request's burst of calls is worked off by every thread
+// without any thread created per call. Each tool may be limited to a
+// number of calls at once, and calls have a deadline.
+//
+// A call past its deadline cannot be interrupted: it keeps its worker and
+// its concurrency slot until it returns, and its result is dropped.
+class ToolExecutor
+{
+public:
+	struct Limit
+	{
+		int max_concurrent = 0;							// 0: no limit
+		std::chrono::milliseconds timeout{0}; // 0: none
+	};
+
+	struct ToolLoad
+	{
+		int running = 0;
+		size_t waiting = 0; // held back by max_concurrent
+		uint64_t timeouts = 0;
+	};
+
+	ToolExecutor(size_t n_threads, Limit defaults);
+	~ToolExecutor();
+
+	// Disable copy
+	ToolExecutor(const ToolExecutor &) = delete;
+	ToolExecutor &operator=(const ToolExecutor &) = delete;
+
+	// Overrides the defaults for one tool. Call before submitting.
+	void set_limit(const std::string &tool, Limit limit);
+
+	ToolFuture submit(const std::string &tool, std::function<json()> call);
+
+	size_t size() const { return workers_.size(); }
+	size_t pending() const { return queued_.load(std::memory_order_relaxed); }
+	std::map<std::string, ToolLoad> load() const;
+
+	// Threads left to tools when n_threads cores decode: the rest of the
+	// machine, but at least 2
+	static size_t default_threads(int n_threads);
+
+private:
+	struct ToolState;
+
+	struct Job
+	{
+		ToolState *tool = nullptr;
+		std::function<json()> call;
+		std::shared_ptr<ToolFuture::State> state;
+	};
+
+	struct ToolState
+	{
+		Limit limit;
+		int running = 0;
+		std::deque<Job> waiting;
+		std::atomic<uint64_t> timeouts{0};
+	};
+
+	// One per worker. The owner takes from the front, thieves from the
+	// back, so they only meet on the last job.
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	Limit defaults_;
+
+	mutable std::mutex tools_mutex_; // guards tools_ and every ToolState
+	std::map<std::string, std::unique_ptr<ToolState>> tools_;
+
+	std::vector<std::unique_ptr<Queue>> queues_;
+	std::atomic<size_t> next_queue_{0};
+	std::atomic<size_t> queued_{0};
+
+	std::mutex wake_mutex_;
+	std::condition_variable wake_cv_;
+	bool stopping_ = false;
+
+	std::vector<std::thread> workers_;
+
+	ToolState &tool_state(const std::string &tool); // tools_mutex_ held
+	void push(size_t queue, Job job);
+	bool take(size_t self, Job &job);
+	void run(size_t self, Job &job);
+	void worker_loop(size_t self);
+};
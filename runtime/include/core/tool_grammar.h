@@ -0,0 +1,15 @@
+#pragma once
+#include <nlohmann/json.hpp>
+#include <string>
+
+using json = nlohmann::json;
+
+// Builds a GBNF grammar (root rule "root") from ToolRegistry::list(). The
+// output is either a plain-text answer, one tool call
+// {"tool":"<name>","arguments":{...}} whose arguments follow that tool's
+// JSON schema, or a JSON array of such calls.
+class ToolGrammar
+{
+public:
+	static std::string build(const json &tools);
+};
@@ -3,7 +3,10 @@
 #include <unordered_map>
 #include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 #include <nlohmann/json.hpp>
+#include "core/metrics.h"
 #include "core/tool.h"
 
 using json = nlohmann::json;
@@ -16,6 +19,15 @@ public:
 	json invoke(const std::string &name, json arguments) const;
 	json list() const;
 
+	// Invocations and their latency per tool, validation failures included
+	std::vector<std::pair<std::string, const CallStats *>> call_stats() const;
+
 private:
-	std::unordered_map<std::string, std::unique_ptr<Tool>> tools_;
+	struct Entry
+	{
+		std::unique_ptr<Tool> tool;
+		std::unique_ptr<CallStats> stats;
+	};
+
+	std::unordered_map<std::string, Entry> tools_;
 };
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+// Spans recorded for one request, from whichever threads work on it, and
+// written out as Chrome trace-event JSON (loads in Perfetto and
+// chrome://tracing). Span names and categories must be string literals.
+class Trace : public std::enable_shared_from_this<Trace>
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	Trace(uint64_t id, std::string path, Clock::time_point start);
+
+	uint64_t id() const { return id_; }
+	const std::string &path() const { return path_; }
+	Clock::time_point start() const { return start_; }
+
+	// A finished span on the calling thread
+	void add(const char *name, const char *category, Clock::time_point start, Clock::time_point end, json args = nullptr);
+
+	json to_json() const;
+
+	// The trace of the request this thread is working on, or nullptr. One
+	// thread-local load, so untraced requests pay nothing else.
+	static Trace *current();
+
+private:
+	struct Event
+	{
+		const char *name;
+		const char *category;
+		Clock::time_point start;
+		Clock::time_point end;
+		uint32_t thread;
+		json args;
+	};
+
+	uint64_t id_;
+	std::string path_;
+	Clock::time_point start_;
+
+	mutable std::mutex mutex_;
+	std::vector<Event> events_;
+};
+
+// Makes trace current on this thread for its lifetime; nullptr is fine
+class TraceScope
+{
+public:
+	explicit TraceScope(std::shared_ptr<Trace> trace);
+	~TraceScope();
+
+	TraceScope(const TraceScope &) = delete;
+	TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+	std::shared_ptr<Trace> trace_;
+	Trace *previous_;
+};
+
+// Records a span from construction to destruction in the current trace,
+// if there is one
+class TraceSpan
+{
+public:
+	explicit TraceSpan(const char *name, const char *category = "runtime");
+	~TraceSpan();
+
+	TraceSpan(const TraceSpan &) = delete;
+	TraceSpan &operator=(const TraceSpan &) = delete;
+
+	bool active() const { return trace_ != nullptr; }
+
+	// Shown with the span in the trace viewer; ignored when not tracing
+	void arg(const char *key, json value);
+
+private:
+	Trace *trace_;
+	const char *name_;
+	const char *category_;
+	Trace::Clock::time_point start_;
+	json args_;
+};
+
+// Decides which requests are traced and writes their traces to files.
+// A request is traced when it asks for it ("trace": true) or is picked by
+// the sample rate.
+class Tracer
+{
+public:
+	static Tracer &instance();
+
+	// sample_rate in [0, 1]: the fraction of all requests traced anyway
+	void configure(const std::string &dir, double sample_rate);
+
+	// nullptr if this request is not traced. start is when its first byte
+	// was read.
+	std::shared_ptr<Trace> begin(const json &request, Trace::Clock::time_point start);
+
+	// Adds the whole-request span and writes the file
+	void finish(Trace &trace);
+
+private:
+	std::mutex mutex_; // guards dir_
+	std::string dir_ = "traces";
+	std::atomic<uint64_t> sample_every_{0}; // 0: never sample
+	std::atomic<uint64_t> requests_{0};
+	std::atomic<uint64_t> next_id_{1};
+
+	Tracer() = default;
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Wire framing for the IPC socket. The mode is picked from the first byte
+// a client sends:
+//
+//   JSON            '{', '[' or whitespace. Each top-level JSON value is a
+//                   frame; NDJSON, pretty-printed and unterminated
+//                   requests all work. Responses end with '\n'.
+//   LENGTH_PREFIXED anything else. Each frame is a 4-byte big-endian
+//                   payload length followed by the payload. Responses use
+//                   the same header.
+enum class FrameMode
+{
+	UNKNOWN,
+	JSON,
+	LENGTH_PREFIXED
+};
+
+// Incremental frame decoder over a single growable receive buffer.
+// Callers read() straight into prepare(), then pull complete frames with
+// next(). Frames are views into the buffer, so a request is never copied
+// between the socket and the JSON parser.
+class FrameReader
+{
+public:
+	// Writable space of at least min_size bytes at the end of the buffer
+	char *prepare(size_t min_size);
+	size_t writable() const { return buffer_.size() - end_; }
+	void commit(size_t n) { end_ += n; }
+
+	// Next complete frame, valid until the following prepare() call
+	bool next(std::string_view &frame);
+
+	// Bytes of an unfinished frame left over once the peer stops sending
+	bool finish(std::string_view &frame);
+
+	FrameMode mode() const { return mode_; }
+	size_t buffered() const { return end_ - start_; }
+
+private:
+	std::vector<char> buffer_;
+	size_t start_ = 0; // first byte of the current frame
+	size_t scan_ = 0;	 // JSON mode: next byte to scan
+	size_t end_ = 0;	 // end of received data
+	FrameMode mode_ = FrameMode::UNKNOWN;
+
+	// JSON mode scanner state, carried across reads
+	int depth_ = 0;
+	bool in_string_ = false;
+	bool escape_ = false;
+	bool seen_value_ = false;
+
+	bool next_json(std::string_view &frame);
+	bool next_length_prefixed(std::string_view &frame);
+	void reset_scanner();
+};
+
+// Append payload to out, framed for the given mode
+void append_frame(std::string &out, FrameMode mode, const std::string &payload);
@@ -1,23 +1,81 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 #include <nlohmann/json.hpp>
 #include "core/action_dispatcher.h"
+#include "core/thread_pool.h"
+#include "ipc/framing.h"
 
 using json = nlohmann::json;
 
 class SocketServer
 {
 public:
-	SocketServer(const std::string &socket_path, ActionDispatcher &dispatcher);
+	SocketServer(const std::string &socket_path, ActionDispatcher &dispatcher, int n_workers = 4);
 	~SocketServer();
 
 	void run();
 
 private:
+	struct Connection
+	{
+		int fd = -1;
+		FrameReader reader;
+		std::string out;
+		size_t out_offset = 0;
+		int in_flight = 0;		 // requests handed to workers, not yet answered
+		uint32_t events = 0;	 // epoll interest currently registered
+		bool read_closed = false;
+		bool broken = false;
+
+		// First read of the bytes now buffered, for request traces
+		std::chrono::steady_clock::time_point read_started;
+
+		// Cleared on close so workers streaming to this client can stop
+		std::shared_ptr<std::atomic<bool>> alive = std::make_shared<std::atomic<bool>>(true);
+	};
+
+	struct Completion
+	{
+		uint64_t conn_id;
+		std::string payload;
+		bool final;
+	};
+
 	std::string socket_path_;
 	int server_fd_;
+	int epoll_fd_;
+	int wake_fd_;
 	ActionDispatcher &dispatcher_;
+	int n_workers_;
+
+	uint64_t next_conn_id_;
+	std::unordered_map<uint64_t, Connection> connections_;
+
+	// Filled by workers, drained by the event loop
+	std::mutex completions_mutex_;
+	std::vector<Completion> completions_;
+
+	// Declared last so workers are joined before the members above go away
+	std::unique_ptr<ThreadPool> workers_;
 
-	void handle_client(int client_fd);
+	bool setup_socket();
+	void accept_clients();
+	void handle_readable(uint64_t conn_id, Connection &conn);
+	void handle_writable(Connection &conn);
+	void dispatch_frames(uint64_t conn_id, Connection &conn);
+	void dispatch_request(uint64_t conn_id, Connection &conn, std::string_view frame);
+	void post_response(uint64_t conn_id, std::string payload, bool final);
+	void drain_completions();
+	void queue_response(Connection &conn, const std::string &payload);
+	void settle(uint64_t conn_id, Connection &conn);
+	void close_connection(uint64_t conn_id);
 };
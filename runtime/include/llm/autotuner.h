@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "llm/llama_config.h"
+
+// Forward declarations from llama.cpp
+struct llama_model;
+
+// Fastest settings found for one context on this host and model
+struct TuneResult
+{
+	int n_threads = 0;			 // decode
+	int n_threads_batch = 0; // prefill
+	int n_ubatch = 0;
+	float decode_tps = 0.0f;
+	float prefill_tps = 0.0f;
+	bool cached = false; // read from the cache file, not measured
+};
+
+// Picks n_threads, n_threads_batch and n_ubatch by timing short decode
+// and prefill probes on a scratch context. Decode is memory-bound and
+// usually peaks well below the core count, so each thread count is
+// swept upwards until throughput stops improving; prefill threads are
+// swept the same way, then n_ubatch at the best of those. Results are
+// cached in config.autotune_cache, keyed by CPU model, hardware threads,
+// context count and model_hash, and reused on later starts.
+bool autotune(llama_model *model, const LlamaConfig &config, uint64_t model_hash, TuneResult &result);
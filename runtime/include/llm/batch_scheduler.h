@@ -0,0 +1,211 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "core/trace.h"
+#include "llm/draft_model.h"
+#include "llm/llama_config.h"
+#include "llm/llama_engine.h"
+#include "llm/sampler_pool.h"
+#include "llm/session_cache.h"
+#include "llm/stop_matcher.h"
+
+// Forward declarations from llama.cpp
+struct llama_model;
+struct llama_context;
+struct llama_sampler;
+struct llama_token_data;
+
+// One generate() call as seen by the scheduler. The caller blocks in
+// wait() while the scheduler thread fills in result.
+struct GenerationTask
+{
+	std::vector<int> tokens;
+	int max_tokens = 0;
+	SamplingParams sampling;
+	std::vector<std::string> stop;
+	TokenCallback on_token;
+	std::string session_id; // empty: not part of a conversation
+	bool prompt_lookup = false;
+	std::string grammar;
+	bool stop_at_json_end = false;
+	int n_keep = 0; // tokens at the start never dropped by context shifting
+
+	// Gets queue, prefill and decode spans when the request is traced
+	std::shared_ptr<Trace> trace;
+
+	// Prefill the prompt and stop, leaving its KV in every idle sequence.
+	// With a snapshot_path the state is loaded from there if it exists and
+	// saved there otherwise.
+	bool prefill_only = false;
+	std::string snapshot_path;
+
+	std::chrono::steady_clock::time_point submitted;
+	GenerateResult result{};
+
+	void finish();
+	void wait();
+
+private:
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	bool done_ = false;
+};
+
+// Continuous batching over one llama_context. Each slot owns a sequence
+// id; every step packs one decode token per generating slot plus prompt
+// chunks of newly admitted requests into a single llama_batch, so
+// requests join and leave at token granularity. With speculation (prompt
+// lookup or a draft model), a generating slot also adds the tokens
+// drafted for it, and keeps the prefix of them that matches what the
+// model samples itself.
+class BatchScheduler
+{
+public:
+	BatchScheduler(llama_model *model, const LlamaConfig &config);
+	~BatchScheduler();
+
+	// Disable copy
+	BatchScheduler(const BatchScheduler &) = delete;
+	BatchScheduler &operator=(const BatchScheduler &) = delete;
+
+	bool start();
+	void stop();
+
+	void submit(std::shared_ptr<GenerationTask> task);
+	void end_session(const std::string &session_id);
+
+	int n_slots() const { return static_cast<int>(slots_.size()); }
+	int load() const { return in_flight_; } // tasks queued or running
+	bool has_draft_model() const { return draft_ != nullptr; }
+	SessionStats session_stats() const;
+	GenerationStats generation_stats() const;
+	SchedulerLoad current_load() const;
+
+private:
+	enum class SlotState
+	{
+		IDLE,
+		PREFILL,
+		GENERATE
+	};
+
+	struct Slot
+	{
+		int id = 0;
+		SlotState state = SlotState::IDLE;
+		std::shared_ptr<GenerationTask> task;
+		std::unique_ptr<FusedSampler> sampler;
+		llama_sampler *grammar = nullptr;
+
+		// Tokens whose KV entries are live for this sequence, in order
+		std::vector<int> cache;
+
+		// Context shifting: cache starts with n_keep pinned tokens, after
+		// which n_discarded tokens of the conversation have been dropped
+		size_t n_keep = 0;
+		size_t n_discarded = 0;
+
+		// Conversation this sequence belongs to; parked when the slot is
+		// given to anything else
+		std::string session_id;
+
+		size_t n_prompt_done = 0; // prompt tokens decoded so far
+		int pending_token = -1;		// sampled, waiting to be decoded
+		std::vector<int> draft;		// speculated to follow pending_token
+		bool draft_from_lookup = false;
+		int batch_index = -1;			// logits row in the current batch
+		size_t n_batched = 0;			// tokens this slot put in the current batch
+		int max_gen = 0;
+
+		std::string text;
+		size_t streamed = 0;
+		StopMatcher stop; // over text, for the task's stop sequences
+
+		// Scanner state over text for stop_at_json_end
+		struct
+		{
+			size_t scanned = 0;
+			int depth = 0;
+			bool in_string = false;
+			bool escape = false;
+			bool not_json = false;
+		} json_end;
+
+		std::chrono::steady_clock::time_point started;
+		std::chrono::steady_clock::time_point last_token; // when the latest tokens were sampled
+
+		// Decode time of the step being sampled, and tokens_generated
+		// before it; record_step() splits the time over its tokens
+		float step_ms = 0.0f;
+		int step_first = 0;
+		std::chrono::steady_clock::time_point last_used;
+	};
+
+	llama_model *model_;
+	LlamaConfig config_;
+	llama_context *ctx_;
+	int n_ctx_slot_;
+	bool can_shift_; // full sequences drop old tokens rather than stop
+	std::unique_ptr<DraftModel> draft_;
+	std::unique_ptr<SamplerPool> samplers_;		 // decode thread only
+	std::vector<llama_token_data> candidates_; // n_vocab entries, for grammar fallbacks
+
+	std::vector<Slot> slots_;
+
+	// Only touched by the decode thread, apart from the counters
+	SessionCache sessions_;
+	std::atomic<uint64_t> session_hits_;
+	std::atomic<uint64_t> session_misses_;
+	std::atomic<int> in_flight_;
+
+	// Published by the decode thread once per step, for current_load()
+	std::atomic<int> n_active_;
+	std::atomic<uint64_t> kv_used_;
+
+	mutable std::mutex stats_mutex_;
+	GenerationStats stats_; // finished generations, under stats_mutex_
+
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::deque<std::shared_ptr<GenerationTask>> pending_;
+	std::vector<std::string> ended_sessions_;
+	bool stopping_;
+	std::thread thread_;
+
+	void warmup();
+	void loop();
+	void publish_load();
+	void admit_pending();
+	void drop_ended_sessions();
+	Slot *pick_slot(const GenerationTask &task);
+	void park_session(Slot &slot);
+	bool restore_session(Slot &slot, const std::string &session_id);
+	bool load_snapshot(Slot &slot);
+	void save_snapshot(const Slot &slot);
+	void share_prefix(const Slot &slot);
+	// grammar: compiled from task->grammar by admit_pending(), or nullptr
+	void start_task(Slot &slot, std::shared_ptr<GenerationTask> task, llama_sampler *grammar);
+	// Ends a task that failed before it was given a slot, so no KV or
+	// session is touched
+	void reject_task(std::shared_ptr<GenerationTask> task, const std::string &message);
+	void drop_discarded(Slot &slot);
+	size_t shorten_prompt(Slot &slot, size_t n_cached);
+	void shift_context(Slot &slot, size_t n_discard);
+	void draft_tokens();
+	void sample_slot(Slot &slot);
+	int sample_token(Slot &slot, int batch_index);
+	bool accept_token(Slot &slot, int token);
+	bool stream_text(Slot &slot, size_t end);
+	bool reached_json_end(Slot &slot);
+	void record_step(Slot &slot);
+	void finish_slot(Slot &slot, const std::string &reason);
+	void fail_slot(Slot &slot, const std::string &message);
+};
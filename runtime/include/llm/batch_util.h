@@ -0,0 +1,15 @@
+#pragma once
+
+#include "llama.h"
+
+// Append one token to a batch, in the style of common_batch_add. The batch
+// must have room for it.
+inline void batch_add(llama_batch &batch, int token, int pos, int seq_id, bool logits)
+{
+	batch.token[batch.n_tokens] = token;
+	batch.pos[batch.n_tokens] = pos;
+	batch.n_seq_id[batch.n_tokens] = 1;
+	batch.seq_id[batch.n_tokens][0] = seq_id;
+	batch.logits[batch.n_tokens] = logits;
+	batch.n_tokens++;
+}
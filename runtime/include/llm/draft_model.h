@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+#include "llm/llama_config.h"
+
+// Forward declarations from llama.cpp
+struct llama_model;
+struct llama_context;
+
+// One sequence asking for a speculative continuation
+struct DraftRequest
+{
+	int seq_id = 0;
+	const std::vector<int> *tokens = nullptr; // tokens the target has in its KV cache
+	int pending_token = -1;										// sampled by the target, not decoded yet
+	int n_draft = 0;
+
+	std::vector<int> draft; // filled by DraftModel::draft()
+};
+
+// A smaller model sharing the target's vocabulary. It keeps its own KV
+// cache per sequence, catches up with whatever the target accepted, and
+// greedily proposes the next few tokens for the target to verify.
+class DraftModel
+{
+public:
+	explicit DraftModel(const LlamaConfig &config);
+	~DraftModel();
+
+	// Disable copy
+	DraftModel(const DraftModel &) = delete;
+	DraftModel &operator=(const DraftModel &) = delete;
+
+	bool load(const llama_model *target, int n_seq);
+
+	// One throwaway decode, so the first draft does not pay for page
+	// faults and buffer setup
+	void warmup();
+
+	// Drafts for all requests are decoded together, one batch per step
+	void draft(std::vector<DraftRequest> &requests);
+
+private:
+	LlamaConfig config_;
+	llama_model *model_;
+	llama_context *ctx_;
+	int n_vocab_;
+
+	// Tokens whose KV entries are live in each draft sequence
+	std::vector<std::vector<int>> cache_;
+
+	int argmax(int batch_index) const;
+};
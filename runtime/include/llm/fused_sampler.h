@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <tuple>
+#include <vector>
+
+// Forward declarations from llama.cpp
+struct llama_token_data;
+struct llama_token_data_array;
+
+// Everything that shapes sampling for one request
+struct SamplingParams
+{
+	float temperature = 0.7f;		 // <= 0: greedy
+	int top_k = 40;							 // <= 0: whole vocabulary
+	float top_p = 0.9f;					 // >= 1: off
+	float repeat_penalty = 1.0f; // 1: off
+	int repeat_last_n = 64;			 // generated tokens the penalty looks back over
+	uint32_t seed = 0xFFFFFFFF;	 // LLAMA_DEFAULT_SEED: random
+
+	bool operator<(const SamplingParams &other) const
+	{
+		return std::tie(temperature, top_k, top_p, repeat_penalty, repeat_last_n, seed) <
+					 std::tie(other.temperature, other.top_k, other.top_p, other.repeat_penalty, other.repeat_last_n, other.seed);
+	}
+};
+
+// Repeat penalty, top-k, top-p, temperature and the final draw as one stage. llama.cpp's
+// chain walks the whole vocabulary in every sampler and sorts it; this
+// finds the top k with one branch-free threshold scan over the raw
+// logits and does the rest on those k alone. Same semantics as
+// penalties -> top_k -> top_p -> temp -> dist. Buffers are sized once,
+// so sampling does not allocate.
+class FusedSampler
+{
+public:
+	FusedSampler(int n_vocab, const SamplingParams &params);
+	~FusedSampler();
+
+	// Starts a new generation with these parameters. With a fixed seed the
+	// random sequence restarts too, so equal requests sample alike.
+	void configure(const SamplingParams &params);
+	const SamplingParams &params() const { return params_; }
+
+	// Applies the repeat penalty to a row of n_vocab logits, in place
+	void penalize(float *logits) const;
+
+	// Samples from one row of n_vocab logits, no candidate array needed
+	int sample(const float *logits);
+
+	// Samples from candidates already filtered by someone else (e.g. a
+	// grammar). Leaves only the survivors, most likely first, with
+	// probabilities and cur->selected set.
+	void apply(llama_token_data_array *cur);
+
+	// apply() for the same token after sample()'s pick was rejected (by a
+	// grammar): reuses sample()'s random number, so a seed gives the same
+	// random sequence whether or not the fallback was needed
+	void retry(llama_token_data_array *cur);
+
+	// Records a token as generated, for the repeat penalty
+	void accept(int token);
+
+private:
+	int n_vocab_;
+	SamplingParams params_;
+	std::mt19937 rng_;
+
+	std::vector<int> recent_; // last repeat_last_n generated tokens, a ring
+	size_t n_recent_;					// tokens recorded so far
+
+	std::vector<float> logits_; // apply()'s candidates, as a flat row
+	std::vector<int> kept_;			// indices into the row, best first
+	std::vector<float> probs_;	// for kept_, after temperature
+	std::vector<float> sample_; // for estimating the top-k threshold
+	int n_kept_;
+	float draw_; // the latest random number in [0, 1)
+
+	std::vector<llama_token_data> out_; // apply()'s survivors
+
+	// Fills kept_/probs_ from a row of n logits; returns the position in
+	// kept_ of the drawn token. redraw: take a new random number, else
+	// reuse draw_.
+	int select(const float *logits, int n, bool redraw);
+	void filter(llama_token_data_array *cur, bool redraw);
+};
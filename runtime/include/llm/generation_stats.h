@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Latencies in milliseconds, counted in log-spaced buckets: four per
+// doubling from 0.1 ms to about 100 s, so any percentile is known to
+// within 19% in constant memory, and histograms add up across contexts.
+class LatencyHistogram
+{
+public:
+	static constexpr int N_BUCKETS = 82; // the last one is open-ended
+
+	// Upper bound of bucket i, in ms, and the bucket a latency falls in
+	static float bound(int bucket);
+	static int bucket_of(float ms);
+
+	// A histogram counted elsewhere, e.g. with atomics
+	static LatencyHistogram from_buckets(const uint64_t *counts, double sum);
+
+	void add(float ms);
+	void merge(const LatencyHistogram &other);
+
+	uint64_t count() const { return count_; }
+	double sum() const { return sum_; }
+	uint64_t bucket_count(int bucket) const { return buckets_[bucket]; }
+
+	// Upper bound of the bucket holding the p-th percentile (0-100); 0 if
+	// nothing was recorded
+	float percentile(float p) const;
+
+private:
+	std::array<uint64_t, N_BUCKETS> buckets_{};
+	uint64_t count_ = 0;
+	double sum_ = 0;
+};
+
+// Exact p-th percentile (0-100) of a request's own latencies
+float percentile(std::vector<float> values, float p);
+
+// Totals over every finished generation
+struct GenerationStats
+{
+	uint64_t requests = 0;
+	uint64_t prompt_tokens = 0;
+	uint64_t prefill_tokens = 0; // prompt tokens actually evaluated
+	uint64_t generated_tokens = 0;
+	double queue_ms = 0;
+	double prefill_ms = 0;
+	double decode_ms = 0;
+
+	LatencyHistogram first_token_ms; // time to first token
+	LatencyHistogram token_ms;			 // between tokens after the first
+
+	void merge(const GenerationStats &other);
+};
+
+// What a scheduler is doing at one moment
+struct SchedulerLoad
+{
+	int queued = 0;				// waiting for a slot
+	int active = 0;				// in a slot, prefilling or generating
+	uint64_t kv_used = 0; // KV cells holding tokens, idle slots' prefixes included
+	uint64_t kv_size = 0;
+
+	void merge(const SchedulerLoad &other);
+};
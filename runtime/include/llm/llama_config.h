@@ -1,8 +1,18 @@
 #pragma once
 
+#include <cstdint>
+#include <map>
 #include <string>
 #include <vector>
 
+// How many calls of one tool may run at once (0: any number), and how
+// long a caller waits for one (0: as long as it takes)
+struct ToolLimitConfig
+{
+	int max_concurrent = 0;
+	int timeout_ms = 0;
+};
+
 struct LlamaConfig
 {
 	// Model path
@@ -12,19 +22,79 @@ struct LlamaConfig
 	int n_threads = 4;
 	int n_threads_batch = 4;
 
+	// NUMA placement of weights and threads: disabled, distribute,
+	// isolate (stay on the node the runtime started on) or numactl (use
+	// the CPU set numactl gave the process)
+	std::string numa = "disabled";
+
+	// Measure the fastest n_threads, n_threads_batch and n_ubatch at
+	// startup instead of using the values above. Results are cached per
+	// CPU and model in autotune_cache (empty: always measure).
+	bool autotune = false;
+	std::string autotune_cache = "cache/autotune.json";
+
 	// Context and memory
 	int n_ctx = 2048;
 	int n_batch = 512;
 	int n_ubatch = 512;
 	bool use_mmap = true;
+	int n_parallel = 1; // sequences decoded together, each with n_ctx tokens
+
+	// KV cache element types (f32, f16, q8_0, q4_0). A quantized V cache
+	// needs flash attention, which is then turned on.
+	std::string cache_type_k = "f16";
+	std::string cache_type_v = "f16";
+	bool flash_attn = false;
+
+	// Host memory the runtime may use in total (0: unlimited). Above it the
+	// KV cache is quantized, then n_parallel and n_ctx are lowered; with
+	// n_parallel = 0 as many sequences as fit are used. See MemoryPlan.
+	int memory_budget_mb = 0;
+
+	// Independent contexts on the same weights, each with n_parallel
+	// sequences and its own decode thread. n_threads is split between them
+	// unless n_threads_per_context is set.
+	int n_contexts = 1;
+	int n_threads_per_context = 0;
 	bool use_mlock = false;
 
+	// Startup: read the model files into the page cache in the background
+	// (optionally on huge pages), and run one decode per context before
+	// serving, so the first request is as fast as later ones
+	bool prefetch = true;
+	bool hugepages = false;
+	bool warmup = true;
+	int session_cache_mb = 512; // host memory for parked conversation KV
+
+	// A sequence that outgrows n_ctx drops its oldest tokens after the
+	// first n_keep (< 0: the system prompt) instead of failing or stopping
+	bool context_shift = true;
+	int n_keep = -1;
+
+	// Prompt prefixes prefilled at startup. Their KV state is saved under
+	// prompt_cache_dir (empty: don't persist) and loaded on the next start.
+	std::vector<std::string> warm_prompts;
+	std::string prompt_cache_dir = "cache/prompts";
+
+	// Speculative decoding: at most n_draft tokens are proposed per step.
+	// A smaller model with the same vocabulary can be the source (empty
+	// path: none).
+	std::string draft_model_path;
+	int n_draft = 8;
+
+	// Prompt-lookup drafting: propose what followed the last occurrence of
+	// the most recent lookup_ngram tokens. Used before the draft model.
+	bool prompt_lookup = false;
+	int lookup_ngram = 3;
+
 	// Generation defaults
 	int max_tokens = 512;
 	float temperature = 0.7f;
 	float top_p = 0.9f;
 	int top_k = 40;
 	float repeat_penalty = 1.1f;
+	int repeat_last_n = 64; // generated tokens the penalty looks back over
+	int64_t seed = -1;			// < 0: random per request
 
 	// Stop sequences
 	std::vector<std::string> stop_sequences = {"\n\n", "###"};
@@ -36,8 +106,25 @@ struct LlamaConfig
 			"{\"tool\":\"tool_name\",\"arguments\":{...}}\n"
 			"Only use tools when necessary.";
 
-	// Logging
+	// Logging. verbose lowers log_level to debug.
 	bool verbose = false;
+	std::string log_level = "info"; // debug, info, warn, error or off
+	std::string log_file;						// empty: stderr
+	std::string log_format = "text"; // text, or json for one object per line
+	int log_body_bytes = 256;				 // request and error bodies are cut to this
+
+	// Request tracing: requests with "trace": true, plus this fraction of
+	// all requests, write Chrome trace-event JSON into trace_dir
+	std::string trace_dir = "traces";
+	float trace_sample_rate = 0.0f;
+
+	// Tool calls run on a shared pool of tool_threads (0: the cores
+	// n_threads leaves free, at least 2). tool_limits overrides the limits
+	// per tool; fields it leaves out keep these defaults.
+	int tool_threads = 0;
+	int tool_max_concurrent = 0;
+	int tool_timeout_ms = 30000;
+	std::map<std::string, ToolLimitConfig> tool_limits;
 
 	static LlamaConfig from_file(const std::string &path);
 	void save_to_file(const std::string &path) const;
@@ -1,14 +1,19 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <functional>
 #include <memory>
 #include <nlohmann/json.hpp>
+#include "llm/generation_stats.h"
 #include "llm/llama_config.h"
+#include "llm/memory_planner.h"
+#include "llm/session_cache.h"
 
 // Forward declarations from llama.cpp
 struct llama_model;
-struct llama_context;
-struct llama_sampler;
+
+class BatchScheduler;
 
 using json = nlohmann::json;
 
@@ -16,9 +21,77 @@ struct GenerateResult
 {
 	std::string text;
 	int tokens_generated;
-	float tokens_per_second;
+	float tokens_per_second; // decode only: tokens after the first / decode_ms
 	bool stopped_by_limit;
 	std::string stop_reason;
+
+	// Prompt size, and how much of it was already in the KV cache
+	int prompt_tokens;
+	int cached_tokens;
+
+	// Timing, measured from when the request reached the engine.
+	// first_token_ms = queue_ms + prefill_ms; total_ms adds decode_ms.
+	float first_token_ms;
+	float total_ms;
+	float queue_ms;		// waiting for a free sequence
+	float prefill_ms; // evaluating the prompt, up to the first token
+	float decode_ms;	// from the first token to the last
+	int prefill_tokens; // prompt tokens evaluated, i.e. not cached
+	float prefill_tokens_per_second;
+
+	// Time between consecutive tokens after the first. Tokens accepted
+	// together from a draft share their step's time.
+	std::vector<float> token_ms;
+	float token_ms_p50;
+	float token_ms_p90;
+	float token_ms_p99;
+
+	// Speculative decoding: tokens proposed by the draft, and how many of
+	// them the model accepted. lookup_* is the part drafted by prompt lookup.
+	int draft_tokens;
+	int draft_accepted;
+	float draft_accept_rate;
+	int lookup_tokens;
+	int lookup_accepted;
+
+	// Sampled token ids, for callers that keep extending the sequence
+	std::vector<int> output_tokens;
+};
+
+// Receives generated text as it is decoded, always cut on UTF-8 character
+// boundaries. Return false to cancel the generation.
+using TokenCallback = std::function<bool(const std::string &piece)>;
+
+struct GenerateOptions
+{
+	int max_tokens = -1;			 // <= 0: config default
+	float temperature = -1.0f; // < 0: config default, 0: greedy
+	std::vector<std::string> stop;
+	TokenCallback on_token;
+
+	// Keeps this conversation's KV state between calls so the next turn
+	// only prefills what was appended
+	std::string session_id;
+
+	// Sampling overrides. < 0: config default
+	int top_k = -1;
+	float top_p = -1.0f;
+	float repeat_penalty = -1.0f;
+	int64_t seed = -1;
+
+	// Tokens at the start of the prompt kept when the context shifts.
+	// < 0: config default
+	int n_keep = -1;
+
+	// Draft from n-gram matches in the prompt and output. < 0: config default
+	int prompt_lookup = -1;
+
+	// GBNF grammar (root rule "root") that constrains sampling
+	std::string grammar;
+
+	// Finish as soon as an output starting with a JSON object or array
+	// closes it
+	bool stop_at_json_end = false;
 };
 
 class LlamaEngine
@@ -36,12 +109,17 @@ public:
 	void unload();
 	bool is_loaded() const { return model_ != nullptr; }
 
-	// Text generation
+	// Text generation. Safe to call from many threads at once; concurrent
+	// calls are decoded together in one batch (see BatchScheduler), on the
+	// least busy of config.n_contexts contexts.
+	GenerateResult generate(const std::string &prompt, const GenerateOptions &options);
+
 	GenerateResult generate(
 			const std::string &prompt,
 			int max_tokens = -1,
 			float temperature = -1.0f,
-			const std::vector<std::string> &stop = {});
+			const std::vector<std::string> &stop = {},
+			const TokenCallback &on_token = nullptr);
 
 	// Chat completion (with conversation history)
 	GenerateResult chat(
@@ -49,23 +127,48 @@ public:
 			int max_tokens = -1,
 			float temperature = -1.0f);
 
+	GenerateResult chat(const std::vector<json> &messages, const GenerateOptions &options);
+
+	// Token-level building blocks for callers that grow one conversation
+	// over several generations (e.g. an agent loop): each step appends
+	// only the tokens of what it adds, and with a session_id only those
+	// are prefilled.
+	GenerateResult generate_tokens(std::vector<int> tokens, const GenerateOptions &options);
+	std::vector<int> tokenize(const std::string &text, bool add_bos = true);
+	std::string format_chat(const std::vector<json> &messages, bool with_system_prompt, bool add_assistant_turn);
+
+	// Forget a session's retained KV state
+	void end_session(const std::string &session_id);
+
+	// Prefill a prefix that later prompts start with, so its KV is already
+	// cached when they arrive. The state is persisted under
+	// config.prompt_cache_dir, keyed by model and prompt, and loaded
+	// instead of prefilled on the next start.
+	bool warm_prompt(const std::string &prefix);
+	bool warm_chat(const std::vector<json> &messages);
+
 	// Get model info
 	std::string model_name() const;
 	int context_size() const;
 	int vocab_size() const;
+	int parallel_slots() const;
+	int decode_threads() const; // over every context, after autotuning
+	SessionStats session_stats() const;
+	GenerationStats generation_stats() const;
+	SchedulerLoad current_load() const;
+	const MemoryPlan &memory_plan() const { return plan_; }
 
 private:
 	LlamaConfig config_;
 	llama_model *model_;
-	llama_context *ctx_;
-	llama_sampler *sampler_;
+	std::vector<std::unique_ptr<BatchScheduler>> schedulers_; // one per context
+	MemoryPlan plan_;
+
+	BatchScheduler &pick_scheduler(const std::string &session_id);
+	uint64_t model_hash_;
+	int n_system_tokens_; // config.system_prompt as format_chat() starts a prompt
 
 	// Helper methods
-	bool ensure_context();
-	void reset_context();
-	std::vector<int> tokenize(const std::string &text, bool add_bos = true);
 	std::string detokenize(const std::vector<int> &tokens);
-	std::string build_chat_prompt(const std::vector<json> &messages);
-	void init_sampler(float temperature);
-	bool check_stop_sequence(const std::string &text, const std::vector<std::string> &stops);
+	std::string snapshot_path(const std::vector<int> &tokens) const;
 };
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "llm/llama_config.h"
+
+// Forward declarations from llama.cpp
+struct llama_model;
+
+// Context layout the runtime runs with, and what it is estimated to cost
+struct MemoryPlan
+{
+	int n_ctx = 0;
+	int n_parallel = 0;
+	int n_contexts = 0;
+	std::string cache_type_k;
+	std::string cache_type_v;
+	bool flash_attn = false;
+
+	uint64_t weights_bytes = 0;	// model weights, plus the draft model's
+	uint64_t kv_bytes = 0;			// KV caches of all contexts
+	uint64_t compute_bytes = 0; // graph and logits buffers of all contexts
+	uint64_t session_bytes = 0; // session_cache_mb
+	uint64_t budget_bytes = 0;	// 0: no budget was given
+	bool fits = true;						// false: even the smallest layout is over budget
+
+	uint64_t total_bytes() const { return weights_bytes + kv_bytes + compute_bytes + session_bytes; }
+};
+
+// The ggml_type for a KV cache type name (f32, f16, q8_0, q4_0), or -1
+int kv_cache_type(const std::string &name);
+
+// Estimates what config costs with this model. With a memory_budget_mb,
+// the layout is shrunk until it fits: the KV cache is quantized first,
+// then parallel sequences are dropped, then n_ctx is halved. With
+// n_parallel = 0 it instead fits as many sequences as it can at the
+// configured cache type. A quantized V cache turns flash attention on,
+// which llama.cpp needs for it.
+MemoryPlan plan_memory(const llama_model *model, const LlamaConfig &config);
+
+// Copies the plan's layout into config
+void apply_memory_plan(const MemoryPlan &plan, LlamaConfig &config);
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Reads model files into the page cache on a background thread, so the
+// disk read overlaps backend, model and context setup instead of
+// showing up as page faults in the first requests. Files are advised
+// MADV_WILLNEED (and MADV_HUGEPAGE if asked), then optionally touched
+// page by page until resident.
+class ModelPrefetch
+{
+public:
+	ModelPrefetch() = default;
+	~ModelPrefetch();
+
+	ModelPrefetch(const ModelPrefetch &) = delete;
+	ModelPrefetch &operator=(const ModelPrefetch &) = delete;
+
+	// touch = false only advises the kernel, leaving the reads to whoever
+	// faults the pages in first. With NUMA that should be the threads
+	// that use them, so their pages land on their own node.
+	void start(std::vector<std::string> paths, bool touch, bool hugepages);
+
+	// Blocks until the files are read; returns the bytes prefetched
+	uint64_t wait();
+
+private:
+	std::thread thread_;
+	std::atomic<uint64_t> bytes_{0};
+};
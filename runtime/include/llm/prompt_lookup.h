@@ -0,0 +1,15 @@
+#pragma once
+
+#include <vector>
+
+// Prompt-lookup drafting: finds the most recent earlier occurrence of the
+// last n tokens (history plus the pending token) and proposes what
+// followed it. Tries n = ngram_max down to 2. Costs no model evaluation,
+// and pays off whenever output repeats the prompt: identifiers, paths,
+// quoted code.
+void prompt_lookup_draft(
+		const std::vector<int> &history,
+		int pending_token,
+		int ngram_max,
+		int n_draft,
+		std::vector<int> &draft);
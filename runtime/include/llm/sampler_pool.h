@@ -0,0 +1,28 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <vector>
+#include "llm/fused_sampler.h"
+
+// Samplers not in use, filed under the parameters they were last
+// configured with. A request prefers one already set up for its
+// parameters; otherwise it takes any idle one and reconfigures it, which
+// is a few field writes. Either way no more samplers (each with
+// vocab-sized buffers) exist than were ever in use at once. Only the
+// decode thread touches it.
+class SamplerPool
+{
+public:
+	explicit SamplerPool(int n_vocab);
+
+	std::unique_ptr<FusedSampler> acquire(const SamplingParams &params);
+	void release(std::unique_ptr<FusedSampler> sampler);
+
+	size_t size() const { return n_created_; }
+
+private:
+	int n_vocab_;
+	size_t n_created_;
+	std::map<SamplingParams, std::vector<std::unique_ptr<FusedSampler>>> idle_;
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct SessionStats
+{
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t evictions = 0;
+	size_t parked = 0;			 // sessions held in host memory
+	size_t parked_bytes = 0; // their serialized KV state
+};
+
+// Memory-bounded LRU of conversation KV snapshots. A session whose slot
+// is handed to another request is parked here and restored into a slot
+// on its next turn; the least recently used ones are dropped once the
+// byte budget is exceeded.
+class SessionCache
+{
+public:
+	struct Entry
+	{
+		std::vector<int> tokens;		// tokens the KV state covers
+		std::vector<uint8_t> state; // llama_state_seq_get_data() blob
+		size_t n_keep = 0;					// context shifting, as in the slot
+		size_t n_discarded = 0;
+	};
+
+	explicit SessionCache(size_t max_bytes);
+
+	void put(const std::string &id, Entry entry);
+	bool take(const std::string &id, Entry &out);
+
+	size_t size() const;
+	size_t bytes() const;
+	uint64_t evictions() const;
+
+private:
+	using Item = std::pair<std::string, Entry>;
+
+	mutable std::mutex mutex_;
+	std::list<Item> lru_; // most recently parked first
+	std::unordered_map<std::string, std::list<Item>::iterator> index_;
+	size_t max_bytes_;
+	size_t bytes_;
+	uint64_t evictions_;
+
+	void erase(std::list<Item>::iterator it);
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Aho-Corasick automaton over a request's stop sequences. Output is fed
+// to it piece by piece as it is detokenized; a stop is found even when it
+// spans several tokens, at the cost of one table lookup per byte and no
+// allocation after construction.
+class StopMatcher
+{
+public:
+	StopMatcher() = default;
+	explicit StopMatcher(const std::vector<std::string> &stops);
+
+	// Back to the start of a new output; keeps the compiled stop set
+	void reset();
+
+	// Consumes the next n bytes of output. Returns the length of output to
+	// keep, i.e. the offset where the first completed stop begins, or
+	// std::string::npos while no stop has completed.
+	size_t feed(const char *data, size_t n);
+
+	// Bytes at the end of the output so far that may be the start of a
+	// stop, and so must not be streamed yet
+	size_t pending() const { return depth_.empty() ? 0 : depth_[state_]; }
+
+	bool empty() const { return depth_.size() <= 1; }
+
+private:
+	// next_[state * 256 + byte], with failure links already folded in
+	std::vector<int32_t> next_;
+	std::vector<uint32_t> depth_; // length of the prefix a state stands for
+	std::vector<uint32_t> match_; // longest stop ending in a state, 0 if none
+
+	int32_t state_ = 0;
+	size_t consumed_ = 0;
+};
@@ -1,12 +1,76 @@
 #include "core/action_dispatcher.h"
 #include "core/error.h"
-#include <regex>
+#include "core/logger.h"
+#include "core/tool_grammar.h"
+#include "core/trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+// Actions route() knows; anything else is counted as "unknown"
+static const char *const ACTIONS[] = {"ping", "infer", "list_tools", "generate", "model_info", "metrics"};
+
+// How often start_metrics_dump() rewrites its file
+static constexpr std::chrono::seconds METRICS_DUMP_INTERVAL(10);
 
 ActionDispatcher::ActionDispatcher(
 		ToolRegistry &registry,
-		std::shared_ptr<LlamaEngine> llm_engine)
-		: tool_registry_(registry), llm_engine_(llm_engine)
+		std::shared_ptr<LlamaEngine> llm_engine,
+		ToolExecutor &tool_executor)
+		: tool_registry_(registry), llm_engine_(llm_engine), tool_executor_(tool_executor)
+{
+	// Tools are all registered before the dispatcher is created
+	tool_grammar_ = ToolGrammar::build(tool_registry_.list());
+
+	for (const char *action : ACTIONS)
+		action_stats_[action];
+	action_stats_["unknown"];
+}
+
+ActionDispatcher::~ActionDispatcher()
+{
+	{
+		std::lock_guard<std::mutex> lock(dump_mutex_);
+		dump_stopping_ = true;
+	}
+	dump_cv_.notify_all();
+
+	if (dump_thread_.joinable())
+		dump_thread_.join();
+}
+
+// Bounds on model -> tools -> model rounds in one infer request
+static constexpr int DEFAULT_AGENT_STEPS = 5;
+static constexpr int MAX_AGENT_STEPS = 16;
+
+// Per-request sampling overrides; anything left out keeps the config value
+static void read_sampling_options(const json &request, GenerateOptions &options)
 {
+	options.max_tokens = request.value("max_tokens", 512);
+	options.temperature = request.value("temperature", -1.0f);
+	options.top_k = request.value("top_k", -1);
+	options.top_p = request.value("top_p", -1.0f);
+	options.repeat_penalty = request.value("repeat_penalty", -1.0f);
+	options.seed = request.value("seed", (int64_t)-1);
+}
+
+// Prefill and decode timing of a result, as flat result fields
+static json timing_json(const GenerateResult &result)
+{
+	return {
+			{"tokens_per_second", result.tokens_per_second},
+			{"first_token_ms", result.first_token_ms},
+			{"total_ms", result.total_ms},
+			{"queue_ms", result.queue_ms},
+			{"prefill_ms", result.prefill_ms},
+			{"decode_ms", result.decode_ms},
+			{"prefill_tokens", result.prefill_tokens},
+			{"prefill_tokens_per_second", result.prefill_tokens_per_second},
+			{"token_ms_p50", result.token_ms_p50},
+			{"token_ms_p90", result.token_ms_p90},
+			{"token_ms_p99", result.token_ms_p99}};
 }
 
 static json error_response(const std::string &action, const json &error)
@@ -17,8 +81,71 @@ static json error_response(const std::string &action, const json &error)
 			{"error", error}};
 }
 
-json ActionDispatcher::dispatch(const json &request)
+json ActionDispatcher::dispatch(const json &request, const FrameSink &emit)
 {
+	if (!request.is_object() || !request.contains("id"))
+		return timed_route(request, emit);
+
+	const json &id = request["id"];
+
+	FrameSink tagged;
+	if (emit)
+	{
+		tagged = [&emit, &id](const json &frame)
+		{
+			json out = frame;
+			out["id"] = id;
+			return emit(out);
+		};
+	}
+
+	json response = timed_route(request, tagged);
+	response["id"] = id;
+	return response;
+}
+
+json ActionDispatcher::timed_route(const json &request, const FrameSink &emit)
+{
+	auto it = action_stats_.end();
+	if (request.is_object() && request.contains("action") && request["action"].is_string())
+		it = action_stats_.find(request["action"].get_ref<const std::string &>());
+	CallStats &stats = it != action_stats_.end() ? it->second : action_stats_.at("unknown");
+
+	TraceSpan span("dispatch");
+	if (span.active())
+		span.arg("action", it != action_stats_.end() ? it->first : "unknown");
+
+	auto start = std::chrono::steady_clock::now();
+	auto elapsed_ms = [start]()
+	{
+		return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	};
+
+	requests_in_flight_.fetch_add(1, std::memory_order_relaxed);
+	try
+	{
+		json response = route(request, emit);
+		requests_in_flight_.fetch_sub(1, std::memory_order_relaxed);
+		stats.record(elapsed_ms(), response.value("status", "") == "ok");
+		return response;
+	}
+	catch (...)
+	{
+		requests_in_flight_.fetch_sub(1, std::memory_order_relaxed);
+		stats.record(elapsed_ms(), false);
+		throw;
+	}
+}
+
+json ActionDispatcher::route(const json &request, const FrameSink &emit)
+{
+	if (!request.is_object())
+	{
+		return {
+				{"status", "error"},
+				{"error", "request must be a JSON object"}};
+	}
+
 	int version = request.value("version", 0);
 	std::string action = request.value("action", "");
 
@@ -43,18 +170,31 @@ json ActionDispatcher::dispatch(const json &request)
 	}
 	else if (action == "generate")
 	{
-		return handle_generate(request);
+		return handle_generate(request, emit);
 	}
 	else if (action == "model_info")
 	{
 		return handle_model_info(request);
 	}
+	else if (action == "metrics")
+	{
+		return handle_metrics(request);
+	}
 
 	return {
 			{"status", "error"},
 			{"error", "unknown action"}};
 }
 
+bool ActionDispatcher::is_long_running(const json &request) const
+{
+	if (!request.is_object())
+		return false;
+
+	std::string action = request.value("action", "");
+	return action == "generate" || action == "infer";
+}
+
 json ActionDispatcher::handle_ping(const json &)
 {
 	return {
@@ -86,8 +226,16 @@ ToolTask ActionDispatcher::submit_tool_call(const json &call)
 		throw std::runtime_error("unknown tool: " + tool);
 	}
 
-	auto fut = std::async(std::launch::async, [this, tool, args]()
-												{
+	// The call shows up in the request's trace, on the thread that runs it,
+	// after the time it waited for that thread
+	std::shared_ptr<Trace> trace = Trace::current() ? Trace::current()->shared_from_this() : nullptr;
+	auto submitted = Trace::Clock::now();
+
+	auto fut = tool_executor_.submit(tool, [this, tool, args, trace, submitted]()
+																	 {
+		TraceScope scope(trace);
+		if (trace)
+			trace->add("tool queue", "tools", submitted, Trace::Clock::now());
 		try {
 			return tool_registry_.invoke(tool, args);
 		} catch (const std::exception &e) {
@@ -104,48 +252,32 @@ ToolTask ActionDispatcher::submit_tool_call(const json &call)
 	return {call_id, tool, std::move(fut)};
 }
 
-bool ActionDispatcher::is_tool_call_response(const std::string &text, json &parsed)
+bool ActionDispatcher::parse_tool_calls(const std::string &text, std::vector<json> &calls)
 {
-	// Try to extract JSON from text
-	// Look for pattern: {"tool":"...", "arguments":{...}}
-
-	std::regex json_pattern(R"(\{[^}]*"tool"[^}]*\})");
-	std::smatch match;
-
-	if (std::regex_search(text, match, json_pattern))
+	// Under the tool grammar the calls are the whole response, and are
+	// valid JSON once they have closed
+	size_t start = text.find_first_not_of(" \t\r\n");
+	if (start == std::string::npos || (text[start] != '{' && text[start] != '['))
+		return false;
+
+	json parsed = json::parse(text.begin() + start, text.end(), nullptr, false);
+	if (parsed.is_object())
+		parsed = json::array({parsed});
+	if (!parsed.is_array() || parsed.empty())
+		return false;
+
+	calls.clear();
+	for (const auto &call : parsed)
 	{
-		try
-		{
-			parsed = json::parse(match.str());
-			if (parsed.contains("tool") && parsed.contains("arguments"))
-			{
-				return true;
-			}
-		}
-		catch (...)
-		{
-			// Not valid JSON
-		}
+		if (!call.is_object() || !call.contains("tool") || !call.contains("arguments"))
+			return false;
+		calls.push_back(call);
 	}
-
-	return false;
+	return true;
 }
 
-json ActionDispatcher::infer_with_ai(const json &request)
+json ActionDispatcher::tool_system_message() const
 {
-	if (!llm_engine_ || !llm_engine_->is_loaded())
-	{
-		return error_response(
-				"infer",
-				make_error(ErrorCode::INTERNAL_ERROR, "LLM engine not available"));
-	}
-
-	const auto &messages = request["messages"];
-
-	// Build prompt with available tools
-	std::vector<json> chat_messages;
-
-	// Add system message with tool definitions
 	json system_msg = {
 			{"role", "system"},
 			{"content", "You have access to these tools:\n"}};
@@ -160,9 +292,34 @@ json ActionDispatcher::infer_with_ai(const json &request)
 	}
 
 	system_msg["content"] = system_msg["content"].get<std::string>() +
-													"\nTo use a tool, respond with JSON: {\"tool\":\"name\",\"arguments\":{...}}";
+													"\nTo use a tool, respond with JSON: {\"tool\":\"name\",\"arguments\":{...}}" +
+													"\nTo use several independent tools at once, respond with a JSON array of such objects.";
 
-	chat_messages.push_back(system_msg);
+	return system_msg;
+}
+
+void ActionDispatcher::warm_up()
+{
+	if (!llm_engine_ || !llm_engine_->is_loaded())
+		return;
+
+	llm_engine_->warm_chat({tool_system_message()});
+}
+
+json ActionDispatcher::infer_with_ai(const json &request)
+{
+	if (!llm_engine_ || !llm_engine_->is_loaded())
+	{
+		return error_response(
+				"infer",
+				make_error(ErrorCode::INTERNAL_ERROR, "LLM engine not available"));
+	}
+
+	const auto &messages = request["messages"];
+
+	// Build prompt with available tools
+	std::vector<json> chat_messages;
+	chat_messages.push_back(tool_system_message());
 
 	// Add conversation messages
 	for (const auto &msg : messages)
@@ -170,61 +327,144 @@ json ActionDispatcher::infer_with_ai(const json &request)
 		chat_messages.push_back(msg);
 	}
 
-	// Generate response
-	int max_tokens = request.value("max_tokens", 512);
-	float temperature = request.value("temperature", 0.7f);
+	// Each step either answers or emits tool calls, and stops as soon as
+	// the calls' JSON is complete
+	GenerateOptions options;
+	read_sampling_options(request, options);
+	options.grammar = tool_grammar_;
+	options.stop_at_json_end = true;
+
+	int max_steps = std::clamp(request.value("max_steps", DEFAULT_AGENT_STEPS), 1, MAX_AGENT_STEPS);
+
+	// Every step continues the same sequence, so the loop runs under a
+	// session: the caller's, or a private one dropped at the end
+	options.session_id = request.value("session_id", "");
+	bool private_session = options.session_id.empty();
+	if (private_session)
+		options.session_id = "infer-" + std::to_string(next_agent_session_++);
+
+	json response;
 
 	try
 	{
-		auto result = llm_engine_->chat(chat_messages, max_tokens, temperature);
-
-		// Check if response is a tool call
-		json tool_call;
-		if (is_tool_call_response(result.text, tool_call))
+		// The conversation is kept as tokens; each step tokenizes and
+		// prefills only what it appends
+		std::vector<int> tokens = llm_engine_->tokenize(llm_engine_->format_chat(chat_messages, true, false), true);
+		const std::vector<int> assistant_turn = llm_engine_->tokenize("Assistant:", false);
+		const std::vector<int> turn_end = llm_engine_->tokenize("\n\n", false);
+
+		// A long loop may outgrow the context; the tool list has to survive
+		options.n_keep = static_cast<int>(
+				llm_engine_->tokenize(llm_engine_->format_chat({chat_messages[0]}, true, false), true).size());
+
+		json tools_used = json::array();
+		int tokens_used = 0;
+		int step = 0;
+		GenerateResult result;
+		GenerateResult timing{}; // summed over the steps
+		auto started = std::chrono::steady_clock::now();
+
+		while (true)
 		{
-			// Execute the tool
-			std::string tool_name = tool_call["tool"];
-			json tool_args = tool_call["arguments"];
+			++step;
 
-			if (!tool_registry_.has(tool_name))
+			TraceSpan step_span("agent step");
+			step_span.arg("step", step);
+
+			// Out of steps: the model has to answer in plain text
+			GenerateOptions step_options = options;
+			if (step == max_steps)
 			{
-				return error_response(
-						"infer",
-						make_error(ErrorCode::UNKNOWN_TOOL, "Tool not found: " + tool_name));
+				step_options.grammar.clear();
+				step_options.stop_at_json_end = false;
 			}
 
-			auto tool_result = tool_registry_.invoke(tool_name, tool_args);
+			tokens.insert(tokens.end(), assistant_turn.begin(), assistant_turn.end());
+			result = llm_engine_->generate_tokens(tokens, step_options);
+			tokens_used += result.tokens_generated;
 
-			// Generate final response with tool result
-			chat_messages.push_back({{"role", "assistant"},
-															 {"content", result.text}});
+			if (step == 1)
+				timing.first_token_ms = result.first_token_ms;
+			timing.queue_ms += result.queue_ms;
+			timing.prefill_ms += result.prefill_ms;
+			timing.decode_ms += result.decode_ms;
+			timing.prefill_tokens += result.prefill_tokens;
+			timing.token_ms.insert(timing.token_ms.end(), result.token_ms.begin(), result.token_ms.end());
 
-			chat_messages.push_back({{"role", "tool"},
-															 {"name", tool_name},
-															 {"content", tool_result.dump()}});
+			if (result.stop_reason == "error")
+				throw std::runtime_error("generation failed");
 
-			auto final_result = llm_engine_->chat(chat_messages, max_tokens, temperature);
+			std::vector<json> calls;
+			if (step == max_steps || !parse_tool_calls(result.text, calls))
+				break;
 
-			return {
-					{"status", "ok"},
-					{"action", "infer"},
-					{"result", {{"type", "assistant"}, {"message", {{"role", "assistant"}, {"content", final_result.text}}}, {"tool_used", tool_name}, {"tokens_used", result.tokens_generated + final_result.tokens_generated}, {"tokens_per_second", final_result.tokens_per_second}}}};
-		}
-		else
-		{
-			// Direct response, no tool needed
-			return {
-					{"status", "ok"},
-					{"action", "infer"},
-					{"result", {{"type", "assistant"}, {"message", {{"role", "assistant"}, {"content", result.text}}}, {"tokens_used", result.tokens_generated}, {"tokens_per_second", result.tokens_per_second}}}};
+			tokens.insert(tokens.end(), result.output_tokens.begin(), result.output_tokens.end());
+			tokens.insert(tokens.end(), turn_end.begin(), turn_end.end());
+
+			// Calls in one step are independent of each other; run them all
+			// at once
+			std::vector<ToolTask> tasks;
+			for (size_t i = 0; i < calls.size(); ++i)
+			{
+				std::string tool_name = calls[i]["tool"];
+				if (!tool_registry_.has(tool_name))
+				{
+					throw std::invalid_argument("Tool not found: " + tool_name);
+				}
+
+				tasks.push_back(submit_tool_call({{"id", "step" + std::to_string(step) + "-" + std::to_string(i)},
+																					{"function", {{"name", tool_name}, {"arguments", calls[i]["arguments"]}}}}));
+			}
+
+			TraceSpan results_span("tool results");
+			for (auto &task : tasks)
+			{
+				json tool_result = task.future.get();
+				tools_used.push_back(task.tool);
+
+				std::vector<json> tool_message = {{{"role", "tool"},
+																					 {"name", task.tool},
+																					 {"content", tool_result.dump()}}};
+				auto appended = llm_engine_->tokenize(llm_engine_->format_chat(tool_message, false, false), false);
+				tokens.insert(tokens.end(), appended.begin(), appended.end());
+			}
 		}
+
+		timing.total_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - started).count();
+		if (timing.decode_ms > 0)
+			timing.tokens_per_second = timing.token_ms.size() / (timing.decode_ms / 1000.0f);
+		if (timing.prefill_ms > 0)
+			timing.prefill_tokens_per_second = timing.prefill_tokens / (timing.prefill_ms / 1000.0f);
+		timing.token_ms_p50 = percentile(timing.token_ms, 50);
+		timing.token_ms_p90 = percentile(timing.token_ms, 90);
+		timing.token_ms_p99 = percentile(timing.token_ms, 99);
+
+		response = {
+				{"status", "ok"},
+				{"action", "infer"},
+				{"result", {{"type", "assistant"}, {"message", {{"role", "assistant"}, {"content", result.text}}}, {"tokens_used", tokens_used}, {"steps", step}, {"tools_used", tools_used}}}};
+		response["result"].update(timing_json(timing));
+
+		if (!tools_used.empty())
+			response["result"]["tool_used"] = tools_used[0];
+	}
+	catch (const std::invalid_argument &e)
+	{
+		response = error_response(
+				"infer",
+				make_error(ErrorCode::UNKNOWN_TOOL, e.what()));
 	}
 	catch (const std::exception &e)
 	{
-		return error_response(
+		response = error_response(
 				"infer",
 				make_error(ErrorCode::INTERNAL_ERROR, e.what()));
 	}
+
+	if (private_session)
+		llm_engine_->end_session(options.session_id);
+
+	return response;
 }
 
 json ActionDispatcher::handle_infer(const json &request)
@@ -349,7 +589,7 @@ json ActionDispatcher::handle_list_tools(const json &)
 			{"result", {{"tools", tool_registry_.list()}}}};
 }
 
-json ActionDispatcher::handle_generate(const json &request)
+json ActionDispatcher::handle_generate(const json &request, const FrameSink &emit)
 {
 	if (!llm_engine_ || !llm_engine_->is_loaded())
 	{
@@ -366,27 +606,54 @@ json ActionDispatcher::handle_generate(const json &request)
 	}
 
 	std::string prompt = request["prompt"];
-	int max_tokens = request.value("max_tokens", 512);
-	float temperature = request.value("temperature", 0.7f);
 
-	std::vector<std::string> stop;
+	GenerateOptions options;
+	read_sampling_options(request, options);
+	options.session_id = request.value("session_id", "");
+	options.n_keep = request.value("n_keep", -1);
+	if (request.contains("prompt_lookup"))
+		options.prompt_lookup = request.value("prompt_lookup", false) ? 1 : 0;
+
 	if (request.contains("stop") && request["stop"].is_array())
 	{
 		for (const auto &s : request["stop"])
 		{
 			if (s.is_string())
-				stop.push_back(s);
+				options.stop.push_back(s);
 		}
 	}
 
+	bool stream = request.value("stream", false) && emit;
+
+	if (stream)
+	{
+		options.on_token = [&emit](const std::string &piece)
+		{
+			return emit({{"status", "ok"},
+									 {"action", "generate"},
+									 {"event", "token"},
+									 {"result", {{"text", piece}}}});
+		};
+	}
+
 	try
 	{
-		auto result = llm_engine_->generate(prompt, max_tokens, temperature, stop);
+		auto result = llm_engine_->generate(prompt, options);
 
-		return {
+		json response = {
 				{"status", "ok"},
 				{"action", "generate"},
-				{"result", {{"text", result.text}, {"tokens_generated", result.tokens_generated}, {"tokens_per_second", result.tokens_per_second}, {"stop_reason", result.stop_reason}, {"stopped_by_limit", result.stopped_by_limit}}}};
+				{"result", {{"text", result.text}, {"tokens_generated", result.tokens_generated}, {"stop_reason", result.stop_reason}, {"stopped_by_limit", result.stopped_by_limit}, {"prompt_tokens", result.prompt_tokens}, {"cached_tokens", result.cached_tokens}, {"draft_tokens", result.draft_tokens}, {"draft_accepted", result.draft_accepted}, {"draft_accept_rate", result.draft_accept_rate}, {"lookup_tokens", result.lookup_tokens}, {"lookup_accepted", result.lookup_accepted}}}};
+		response["result"].update(timing_json(result));
+
+		// The text already went out in token frames
+		if (stream)
+		{
+			response["event"] = "done";
+			response["result"].erase("text");
+		}
+
+		return response;
 	}
 	catch (const std::exception &e)
 	{
@@ -406,8 +673,244 @@ json ActionDispatcher::handle_model_info(const json &)
 				{"result", {{"loaded", false}}}};
 	}
 
+	SessionStats sessions = llm_engine_->session_stats();
+	const MemoryPlan &plan = llm_engine_->memory_plan();
+
+	auto mb = [](uint64_t bytes)
+	{
+		return bytes >> 20;
+	};
+	json memory = {
+			{"n_ctx", plan.n_ctx},
+			{"n_parallel", plan.n_parallel},
+			{"n_contexts", plan.n_contexts},
+			{"cache_type_k", plan.cache_type_k},
+			{"cache_type_v", plan.cache_type_v},
+			{"flash_attn", plan.flash_attn},
+			{"weights_mb", mb(plan.weights_bytes)},
+			{"kv_mb", mb(plan.kv_bytes)},
+			{"compute_mb", mb(plan.compute_bytes)},
+			{"sessions_mb", mb(plan.session_bytes)},
+			{"total_mb", mb(plan.total_bytes())},
+			{"budget_mb", mb(plan.budget_bytes)},
+			{"fits", plan.fits}};
+
+	// Server-wide, over every finished generate and infer step
+	GenerationStats stats = llm_engine_->generation_stats();
+	auto percentiles = [](const LatencyHistogram &histogram)
+	{
+		return json{
+				{"p50", histogram.percentile(50)},
+				{"p90", histogram.percentile(90)},
+				{"p99", histogram.percentile(99)}};
+	};
+	json generation = {
+			{"requests", stats.requests},
+			{"prompt_tokens", stats.prompt_tokens},
+			{"prefill_tokens", stats.prefill_tokens},
+			{"generated_tokens", stats.generated_tokens},
+			{"prefill_tokens_per_second", stats.prefill_ms > 0 ? stats.prefill_tokens / (stats.prefill_ms / 1000.0) : 0.0},
+			{"decode_tokens_per_second", stats.decode_ms > 0 ? stats.token_ms.count() / (stats.decode_ms / 1000.0) : 0.0},
+			{"queue_ms_avg", stats.requests > 0 ? stats.queue_ms / stats.requests : 0.0},
+			{"first_token_ms", percentiles(stats.first_token_ms)},
+			{"token_ms", percentiles(stats.token_ms)}};
+
 	return {
 			{"status", "ok"},
 			{"action", "model_info"},
-			{"result", {{"loaded", true}, {"model_name", llm_engine_->model_name()}, {"context_size", llm_engine_->context_size()}, {"vocab_size", llm_engine_->vocab_size()}}}};
+			{"result", {{"loaded", true}, {"model_name", llm_engine_->model_name()}, {"context_size", llm_engine_->context_size()}, {"vocab_size", llm_engine_->vocab_size()}, {"parallel_slots", llm_engine_->parallel_slots()}, {"sessions", {{"hits", sessions.hits}, {"misses", sessions.misses}, {"evictions", sessions.evictions}, {"parked", sessions.parked}, {"parked_bytes", sessions.parked_bytes}}}, {"memory", memory}, {"generation", generation}}}};
+}
+
+void ActionDispatcher::set_worker_pool(const ThreadPool *pool)
+{
+	std::lock_guard<std::mutex> lock(pool_mutex_);
+	worker_pool_ = pool;
+}
+
+static json call_json(const CallStats &stats)
+{
+	LatencyHistogram latency = stats.latency.snapshot();
+	return {
+			{"calls", stats.calls.load(std::memory_order_relaxed)},
+			{"errors", stats.errors.load(std::memory_order_relaxed)},
+			{"mean_ms", latency.count() > 0 ? latency.sum() / latency.count() : 0.0},
+			{"p50_ms", latency.percentile(50)},
+			{"p95_ms", latency.percentile(95)},
+			{"p99_ms", latency.percentile(99)}};
+}
+
+json ActionDispatcher::metrics_json()
+{
+	json requests = json::object();
+	for (const auto &[action, stats] : action_stats_)
+		requests[action] = call_json(stats);
+
+	json tools = json::object();
+	for (const auto &[tool, stats] : tool_registry_.call_stats())
+		tools[tool] = call_json(*stats);
+
+	json workers = {{"threads", 0}, {"queue_depth", 0}};
+	{
+		std::lock_guard<std::mutex> lock(pool_mutex_);
+		if (worker_pool_)
+			workers = {{"threads", worker_pool_->size()}, {"queue_depth", worker_pool_->pending()}};
+	}
+
+	for (const auto &[tool, load] : tool_executor_.load())
+	{
+		if (!tools.contains(tool))
+			continue;
+		tools[tool]["running"] = load.running;
+		tools[tool]["waiting"] = load.waiting;
+		tools[tool]["timeouts"] = load.timeouts;
+	}
+
+	json metrics = {
+			{"requests", requests},
+			{"requests_in_flight", requests_in_flight_.load(std::memory_order_relaxed)},
+			{"tools", tools},
+			{"tool_executor", {{"threads", tool_executor_.size()}, {"queue_depth", tool_executor_.pending()}}},
+			{"workers", workers}};
+
+	if (llm_engine_ && llm_engine_->is_loaded())
+	{
+		SchedulerLoad load = llm_engine_->current_load();
+		GenerationStats stats = llm_engine_->generation_stats();
+
+		metrics["generation"] = {
+				{"queued", load.queued},
+				{"active", load.active},
+				{"kv_used", load.kv_used},
+				{"kv_size", load.kv_size},
+				{"kv_occupancy", load.kv_size > 0 ? static_cast<double>(load.kv_used) / load.kv_size : 0.0},
+				{"requests", stats.requests},
+				{"generated_tokens", stats.generated_tokens},
+				{"prefill_tokens_per_second", stats.prefill_ms > 0 ? stats.prefill_tokens / (stats.prefill_ms / 1000.0) : 0.0},
+				{"decode_tokens_per_second", stats.decode_ms > 0 ? stats.token_ms.count() / (stats.decode_ms / 1000.0) : 0.0},
+				{"first_token_p50_ms", stats.first_token_ms.percentile(50)},
+				{"first_token_p95_ms", stats.first_token_ms.percentile(95)},
+				{"first_token_p99_ms", stats.first_token_ms.percentile(99)}};
+	}
+
+	return metrics;
+}
+
+std::string ActionDispatcher::metrics_text()
+{
+	std::ostringstream out;
+
+	Prometheus::header(out, "forge_requests_total", "counter", "Requests by action.");
+	for (const auto &[action, stats] : action_stats_)
+		Prometheus::sample(out, "forge_requests_total", "action=\"" + action + "\"", stats.calls.load(std::memory_order_relaxed));
+	Prometheus::header(out, "forge_request_errors_total", "counter", "Requests by action that did not answer ok.");
+	for (const auto &[action, stats] : action_stats_)
+		Prometheus::sample(out, "forge_request_errors_total", "action=\"" + action + "\"", stats.errors.load(std::memory_order_relaxed));
+	Prometheus::header(out, "forge_request_duration_seconds", "histogram", "Time from dispatch to response, by action.");
+	for (const auto &[action, stats] : action_stats_)
+		Prometheus::histogram(out, "forge_request_duration_seconds", "action=\"" + action + "\"", stats.latency.snapshot());
+
+	auto tools = tool_registry_.call_stats();
+	Prometheus::header(out, "forge_tool_calls_total", "counter", "Tool invocations by tool.");
+	for (const auto &[tool, stats] : tools)
+		Prometheus::sample(out, "forge_tool_calls_total", "tool=\"" + tool + "\"", stats->calls.load(std::memory_order_relaxed));
+	Prometheus::header(out, "forge_tool_errors_total", "counter", "Tool invocations by tool that failed.");
+	for (const auto &[tool, stats] : tools)
+		Prometheus::sample(out, "forge_tool_errors_total", "tool=\"" + tool + "\"", stats->errors.load(std::memory_order_relaxed));
+	Prometheus::header(out, "forge_tool_duration_seconds", "histogram", "Tool run time, argument validation included.");
+	for (const auto &[tool, stats] : tools)
+		Prometheus::histogram(out, "forge_tool_duration_seconds", "tool=\"" + tool + "\"", stats->latency.snapshot());
+
+	auto tool_load = tool_executor_.load();
+	Prometheus::header(out, "forge_tool_timeouts_total", "counter", "Tool calls abandoned at their timeout.");
+	for (const auto &[tool, load] : tool_load)
+		Prometheus::sample(out, "forge_tool_timeouts_total", "tool=\"" + tool + "\"", load.timeouts);
+	Prometheus::header(out, "forge_tool_calls_running", "gauge", "Tool calls running, by tool.");
+	for (const auto &[tool, load] : tool_load)
+		Prometheus::sample(out, "forge_tool_calls_running", "tool=\"" + tool + "\"", load.running);
+	Prometheus::header(out, "forge_tool_calls_waiting", "gauge", "Tool calls held back by the tool's concurrency limit.");
+	for (const auto &[tool, load] : tool_load)
+		Prometheus::sample(out, "forge_tool_calls_waiting", "tool=\"" + tool + "\"", load.waiting);
+	Prometheus::header(out, "forge_tool_queue_depth", "gauge", "Tool calls waiting for an executor thread.");
+	Prometheus::sample(out, "forge_tool_queue_depth", "", tool_executor_.pending());
+
+	Prometheus::header(out, "forge_requests_in_flight", "gauge", "Requests being handled.");
+	Prometheus::sample(out, "forge_requests_in_flight", "", requests_in_flight_.load(std::memory_order_relaxed));
+
+	{
+		std::lock_guard<std::mutex> lock(pool_mutex_);
+		Prometheus::header(out, "forge_worker_queue_depth", "gauge", "Long-running requests waiting for a worker thread.");
+		Prometheus::sample(out, "forge_worker_queue_depth", "", worker_pool_ ? worker_pool_->pending() : 0);
+	}
+
+	if (llm_engine_ && llm_engine_->is_loaded())
+	{
+		SchedulerLoad load = llm_engine_->current_load();
+		GenerationStats stats = llm_engine_->generation_stats();
+
+		Prometheus::header(out, "forge_generations_queued", "gauge", "Generations waiting for a sequence slot.");
+		Prometheus::sample(out, "forge_generations_queued", "", load.queued);
+		Prometheus::header(out, "forge_generations_active", "gauge", "Generations prefilling or decoding.");
+		Prometheus::sample(out, "forge_generations_active", "", load.active);
+		Prometheus::header(out, "forge_kv_cells_used", "gauge", "KV cache cells holding tokens.");
+		Prometheus::sample(out, "forge_kv_cells_used", "", load.kv_used);
+		Prometheus::header(out, "forge_kv_cells", "gauge", "KV cache cells over every sequence slot.");
+		Prometheus::sample(out, "forge_kv_cells", "", load.kv_size);
+
+		Prometheus::header(out, "forge_generations_total", "counter", "Finished generations.");
+		Prometheus::sample(out, "forge_generations_total", "", stats.requests);
+		Prometheus::header(out, "forge_prefill_tokens_total", "counter", "Prompt tokens evaluated, cached ones excluded.");
+		Prometheus::sample(out, "forge_prefill_tokens_total", "", stats.prefill_tokens);
+		Prometheus::header(out, "forge_generated_tokens_total", "counter", "Tokens generated.");
+		Prometheus::sample(out, "forge_generated_tokens_total", "", stats.generated_tokens);
+		Prometheus::header(out, "forge_prefill_seconds_total", "counter", "Time spent prefilling prompts.");
+		Prometheus::sample(out, "forge_prefill_seconds_total", "", stats.prefill_ms / 1000.0);
+		Prometheus::header(out, "forge_decode_seconds_total", "counter", "Time spent decoding after the first token.");
+		Prometheus::sample(out, "forge_decode_seconds_total", "", stats.decode_ms / 1000.0);
+		Prometheus::header(out, "forge_time_to_first_token_seconds", "histogram", "Time from submission to the first generated token.");
+		Prometheus::histogram(out, "forge_time_to_first_token_seconds", "", stats.first_token_ms);
+		Prometheus::header(out, "forge_inter_token_seconds", "histogram", "Time between generated tokens.");
+		Prometheus::histogram(out, "forge_inter_token_seconds", "", stats.token_ms);
+	}
+
+	return out.str();
+}
+
+json ActionDispatcher::handle_metrics(const json &request)
+{
+	if (request.value("format", "json") == "prometheus")
+	{
+		return {
+				{"status", "ok"},
+				{"action", "metrics"},
+				{"result", {{"format", "prometheus"}, {"text", metrics_text()}}}};
+	}
+
+	return {
+			{"status", "ok"},
+			{"action", "metrics"},
+			{"result", metrics_json()}};
+}
+
+void ActionDispatcher::start_metrics_dump(const std::string &path)
+{
+	dump_thread_ = std::thread([this, path]()
+														 {
+		std::unique_lock<std::mutex> lock(dump_mutex_);
+		while (!dump_stopping_)
+		{
+			lock.unlock();
+
+			// Scrapers never see a half-written file
+			std::string tmp = path + ".tmp";
+			{
+				std::ofstream file(tmp, std::ios::trunc);
+				file << metrics_text();
+			}
+			if (std::rename(tmp.c_str(), path.c_str()) != 0)
+				LOG_WARN("metrics", "Cannot write " << path);
+
+			lock.lock();
+			dump_cv_.wait_for(lock, METRICS_DUMP_INTERVAL, [this]()
+												{ return dump_stopping_; });
+		} });
 }
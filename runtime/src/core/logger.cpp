@@ -0,0 +1,272 @@
+#include "core/logger.h"
+#include <cctype>
+#include <ctime>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+// How long the writer sleeps when the ring is empty; a wakeup lost to the
+// unlocked notify in write() costs at most this much delay
+static constexpr std::chrono::milliseconds WRITER_IDLE(50);
+
+static const char *level_name(LogLevel level)
+{
+	switch (level)
+	{
+	case LogLevel::DEBUG:
+		return "debug";
+	case LogLevel::INFO:
+		return "info";
+	case LogLevel::WARN:
+		return "warn";
+	case LogLevel::ERROR:
+		return "error";
+	default:
+		return "off";
+	}
+}
+
+bool parse_log_level(const std::string &name, LogLevel &level)
+{
+	for (LogLevel candidate : {LogLevel::DEBUG, LogLevel::INFO, LogLevel::WARN, LogLevel::ERROR, LogLevel::OFF})
+	{
+		if (name == level_name(candidate))
+		{
+			level = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+uint32_t thread_number()
+{
+	static std::atomic<uint32_t> next{1};
+	thread_local uint32_t number = next.fetch_add(1, std::memory_order_relaxed);
+	return number;
+}
+
+Logger &Logger::instance()
+{
+	static Logger logger;
+	return logger;
+}
+
+Logger::Logger()
+		: cells_(std::make_unique<Cell[]>(CAPACITY)),
+			head_(0),
+			tail_(0),
+			dropped_(0),
+			pushed_(0),
+			written_(0),
+			level_(static_cast<int>(LogLevel::INFO)),
+			body_bytes_(256),
+			out_(stderr),
+			json_(false),
+			stopping_(false)
+{
+	for (size_t i = 0; i < CAPACITY; ++i)
+		cells_[i].sequence.store(i, std::memory_order_relaxed);
+
+	writer_ = std::thread(&Logger::writer_loop, this);
+}
+
+Logger::~Logger()
+{
+	{
+		std::lock_guard<std::mutex> lock(wake_mutex_);
+		stopping_ = true;
+	}
+	wake_cv_.notify_one();
+
+	if (writer_.joinable())
+		writer_.join();
+
+	if (out_ != stderr)
+		std::fclose(out_);
+}
+
+bool Logger::configure(LogLevel level, const std::string &path, bool json, size_t body_bytes)
+{
+	level_.store(static_cast<int>(level), std::memory_order_relaxed);
+	body_bytes_.store(body_bytes, std::memory_order_relaxed);
+
+	FILE *out = stderr;
+	if (!path.empty())
+	{
+		out = std::fopen(path.c_str(), "a");
+		if (!out)
+			return false;
+	}
+
+	std::lock_guard<std::mutex> lock(sink_mutex_);
+	if (out_ != stderr)
+		std::fclose(out_);
+	out_ = out;
+	json_ = json;
+	return true;
+}
+
+void Logger::write(LogLevel level, const char *component, std::string message)
+{
+	size_t pos = head_.load(std::memory_order_relaxed);
+	while (true)
+	{
+		Cell &cell = cells_[pos & (CAPACITY - 1)];
+		size_t sequence = cell.sequence.load(std::memory_order_acquire);
+		intptr_t lag = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+
+		if (lag == 0)
+		{
+			if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			{
+				cell.record.level = level;
+				cell.record.component = component;
+				cell.record.thread = thread_number();
+				cell.record.time = std::chrono::system_clock::now();
+				cell.record.message = std::move(message);
+				cell.sequence.store(pos + 1, std::memory_order_release);
+				break;
+			}
+		}
+		else if (lag < 0)
+		{
+			// The writer has not freed this cell yet: the ring is full
+			dropped_.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		else
+		{
+			pos = head_.load(std::memory_order_relaxed);
+		}
+	}
+
+	pushed_.fetch_add(1, std::memory_order_release);
+	wake_cv_.notify_one();
+}
+
+bool Logger::pop(Record &record)
+{
+	Cell &cell = cells_[tail_ & (CAPACITY - 1)];
+	if (cell.sequence.load(std::memory_order_acquire) != tail_ + 1)
+		return false;
+
+	record = std::move(cell.record);
+	cell.sequence.store(tail_ + CAPACITY, std::memory_order_release);
+	tail_++;
+	return true;
+}
+
+std::string Logger::excerpt(std::string_view body) const
+{
+	size_t limit = body_bytes_.load(std::memory_order_relaxed);
+	if (body.size() <= limit)
+		return std::string(body);
+
+	std::string cut(body.substr(0, limit));
+	cut += "... (" + std::to_string(body.size()) + " bytes)";
+	return cut;
+}
+
+void Logger::flush()
+{
+	uint64_t target = pushed_.load(std::memory_order_acquire);
+	wake_cv_.notify_one();
+
+	std::unique_lock<std::mutex> lock(wake_mutex_);
+	flushed_cv_.wait_for(lock, std::chrono::seconds(1), [this, target]()
+											 { return written_.load(std::memory_order_relaxed) >= target || stopping_; });
+}
+
+void Logger::format(const Record &record, std::string &out) const
+{
+	auto since_epoch = record.time.time_since_epoch();
+	std::time_t seconds = std::chrono::duration_cast<std::chrono::seconds>(since_epoch).count();
+	int millis = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(since_epoch).count() % 1000);
+
+	std::tm utc{};
+	gmtime_r(&seconds, &utc);
+	char stamp[32];
+	size_t n = std::strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &utc);
+	std::snprintf(stamp + n, sizeof(stamp) - n, ".%03dZ", millis);
+
+	if (json_)
+	{
+		nlohmann::ordered_json line = {
+				{"ts", stamp},
+				{"level", level_name(record.level)},
+				{"component", record.component},
+				{"thread", record.thread},
+				{"msg", record.message}};
+		out += line.dump(-1, ' ', false, json::error_handler_t::replace);
+		out += '\n';
+		return;
+	}
+
+	char level[8];
+	std::snprintf(level, sizeof(level), "%-5s", level_name(record.level));
+	for (char *c = level; *c; ++c)
+		*c = static_cast<char>(std::toupper(static_cast<unsigned char>(*c)));
+
+	out += stamp;
+	out += ' ';
+	out += level;
+	out += " [";
+	out += record.component;
+	out += "] ";
+	out += record.message;
+	out += '\n';
+}
+
+void Logger::writer_loop()
+{
+	std::string buffer;
+	Record record;
+
+	while (true)
+	{
+		buffer.clear();
+		uint64_t n_popped = 0;
+		{
+			// Formatting reads json_, so hold off configure() meanwhile
+			std::lock_guard<std::mutex> sink(sink_mutex_);
+
+			while (n_popped < CAPACITY && pop(record))
+			{
+				format(record, buffer);
+				n_popped++;
+			}
+
+			uint64_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+			if (dropped > 0)
+			{
+				Record note;
+				note.level = LogLevel::WARN;
+				note.component = "logger";
+				note.time = std::chrono::system_clock::now();
+				note.message = std::to_string(dropped) + " records dropped, the log ring was full";
+				format(note, buffer);
+			}
+
+			if (!buffer.empty())
+			{
+				std::fwrite(buffer.data(), 1, buffer.size(), out_);
+				std::fflush(out_);
+			}
+		}
+
+		std::unique_lock<std::mutex> lock(wake_mutex_);
+		if (n_popped > 0)
+		{
+			written_.fetch_add(n_popped, std::memory_order_relaxed);
+			flushed_cv_.notify_all();
+			continue;
+		}
+
+		if (stopping_)
+			break;
+
+		wake_cv_.wait_for(lock, WRITER_IDLE, [this]()
+											{ return stopping_ || pushed_.load(std::memory_order_acquire) > written_.load(std::memory_order_relaxed); });
+	}
+}
@@ -0,0 +1,71 @@
+#include "core/metrics.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+void AtomicHistogram::add(float ms)
+{
+	buckets_[LatencyHistogram::bucket_of(ms)].fetch_add(1, std::memory_order_relaxed);
+	sum_us_.fetch_add(static_cast<uint64_t>(std::max(ms, 0.0f) * 1000.0f), std::memory_order_relaxed);
+}
+
+LatencyHistogram AtomicHistogram::snapshot() const
+{
+	uint64_t counts[LatencyHistogram::N_BUCKETS];
+	for (int i = 0; i < LatencyHistogram::N_BUCKETS; ++i)
+		counts[i] = buckets_[i].load(std::memory_order_relaxed);
+	return LatencyHistogram::from_buckets(counts, sum_us_.load(std::memory_order_relaxed) / 1000.0);
+}
+
+void CallStats::record(float ms, bool ok)
+{
+	calls.fetch_add(1, std::memory_order_relaxed);
+	if (!ok)
+		errors.fetch_add(1, std::memory_order_relaxed);
+	latency.add(ms);
+}
+
+// Exact for counters; bucket bounds are floats and want fewer digits
+static std::string number(double value, int digits = 10)
+{
+	if (std::isinf(value))
+		return value > 0 ? "+Inf" : "-Inf";
+
+	char buf[32];
+	std::snprintf(buf, sizeof(buf), "%.*g", digits, value);
+	return buf;
+}
+
+void Prometheus::header(std::ostream &out, const std::string &name, const std::string &type, const std::string &help)
+{
+	out << "# HELP " << name << " " << help << "\n";
+	out << "# TYPE " << name << " " << type << "\n";
+}
+
+void Prometheus::sample(std::ostream &out, const std::string &name, const std::string &labels, double value)
+{
+	out << name;
+	if (!labels.empty())
+		out << "{" << labels << "}";
+	out << " " << number(value) << "\n";
+}
+
+void Prometheus::histogram(std::ostream &out, const std::string &name, const std::string &labels, const LatencyHistogram &ms)
+{
+	// Every bucket would be 82 lines a series; one per doubling keeps the
+	// quantiles Prometheus interpolates within a factor of two
+	static constexpr int STRIDE = 4;
+
+	std::string prefix = labels.empty() ? "" : labels + ",";
+
+	uint64_t seen = 0;
+	for (int i = 0; i < LatencyHistogram::N_BUCKETS - 1; ++i)
+	{
+		seen += ms.bucket_count(i);
+		if (i % STRIDE == 0)
+			sample(out, name + "_bucket", prefix + "le=\"" + number(LatencyHistogram::bound(i) / 1000.0, 4) + "\"", seen);
+	}
+	sample(out, name + "_bucket", prefix + "le=\"+Inf\"", ms.count());
+	sample(out, name + "_sum", labels, ms.sum() / 1000.0);
+	sample(out, name + "_count", labels, ms.count());
+}
@@ -0,0 +1,76 @@
+#include "core/thread_pool.h"
+
+#include "core/logger.h"
+
+ThreadPool::ThreadPool(size_t n_threads)
+		: stopping_(false)
+{
+	if (n_threads == 0)
+		n_threads = 1;
+
+	workers_.reserve(n_threads);
+	for (size_t i = 0; i < n_threads; ++i)
+	{
+		workers_.emplace_back(&ThreadPool::worker_loop, this);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	cv_.notify_all();
+
+	for (auto &worker : workers_)
+	{
+		if (worker.joinable())
+			worker.join();
+	}
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		queue_.push_back(std::move(task));
+	}
+	cv_.notify_one();
+}
+
+size_t ThreadPool::pending() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return queue_.size();
+}
+
+void ThreadPool::worker_loop()
+{
+	while (true)
+	{
+		std::function<void()> task;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			cv_.wait(lock, [this]()
+							 { return stopping_ || !queue_.empty(); });
+
+			// Drain remaining work before exiting
+			if (queue_.empty())
+				return;
+
+			task = std::move(queue_.front());
+			queue_.pop_front();
+		}
+
+		try
+		{
+			task();
+		}
+		catch (const std::exception &e)
+		{
+			LOG_ERROR("ThreadPool", "Task failed: " << e.what());
+		}
+	}
+}
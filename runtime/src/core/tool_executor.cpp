@@ -0,0 +1,244 @@
+#include "core/tool_executor.h"
+#include "core/error.h"
+#include <algorithm>
+#include <stdexcept>
+
+json ToolFuture::get()
+{
+	if (!state_)
+		throw std::logic_error("ToolFuture has no call");
+
+	State &state = *state_;
+	std::unique_lock<std::mutex> lock(state.mutex);
+
+	auto done = [&state]()
+	{ return state.done; };
+
+	if (state.deadline == std::chrono::steady_clock::time_point::max())
+	{
+		state.cv.wait(lock, done);
+	}
+	else if (!state.cv.wait_until(lock, state.deadline, done))
+	{
+		state.abandoned = true;
+		if (state.timeouts)
+			state.timeouts->fetch_add(1, std::memory_order_relaxed);
+
+		return {
+				{"error", make_error(
+											ErrorCode::TOOL_TIMEOUT,
+											"tool call did not finish within " + std::to_string(state.timeout.count()) + " ms",
+											"",
+											state.tool)}};
+	}
+
+	if (state.error)
+		std::rethrow_exception(state.error);
+	return std::move(state.result);
+}
+
+ToolExecutor::ToolExecutor(size_t n_threads, Limit defaults)
+		: defaults_(defaults)
+{
+	if (n_threads == 0)
+		n_threads = 1;
+
+	queues_.reserve(n_threads);
+	for (size_t i = 0; i < n_threads; ++i)
+		queues_.push_back(std::make_unique<Queue>());
+
+	workers_.reserve(n_threads);
+	for (size_t i = 0; i < n_threads; ++i)
+		workers_.emplace_back(&ToolExecutor::worker_loop, this, i);
+}
+
+ToolExecutor::~ToolExecutor()
+{
+	{
+		std::lock_guard<std::mutex> lock(wake_mutex_);
+		stopping_ = true;
+	}
+	wake_cv_.notify_all();
+
+	// Workers drain the queues, and calls held back by a limit are
+	// requeued as slots free up, before the threads exit
+	for (auto &worker : workers_)
+	{
+		if (worker.joinable())
+			worker.join();
+	}
+}
+
+size_t ToolExecutor::default_threads(int n_threads)
+{
+	size_t cores = std::thread::hardware_concurrency();
+	if (cores == 0)
+		cores = 4;
+
+	size_t decode = static_cast<size_t>(std::max(n_threads, 0));
+	return std::max<size_t>(2, cores > decode ? cores - decode : 0);
+}
+
+void ToolExecutor::set_limit(const std::string &tool, Limit limit)
+{
+	std::lock_guard<std::mutex> lock(tools_mutex_);
+	tool_state(tool).limit = limit;
+}
+
+ToolExecutor::ToolState &ToolExecutor::tool_state(const std::string &tool)
+{
+	auto &entry = tools_[tool];
+	if (!entry)
+	{
+		entry = std::make_unique<ToolState>();
+		entry->limit = defaults_;
+	}
+	return *entry;
+}
+
+ToolFuture ToolExecutor::submit(const std::string &tool, std::function<json()> call)
+{
+	auto state = std::make_shared<ToolFuture::State>();
+	ToolState *target;
+	{
+		std::lock_guard<std::mutex> lock(tools_mutex_);
+		target = &tool_state(tool);
+		state->timeout = target->limit.timeout;
+	}
+	state->tool = tool;
+	state->timeouts = &target->timeouts;
+	state->deadline = state->timeout.count() > 0
+												? std::chrono::steady_clock::now() + state->timeout
+												: std::chrono::steady_clock::time_point::max();
+
+	size_t queue = next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+	push(queue, {target, std::move(call), state});
+
+	return ToolFuture(std::move(state));
+}
+
+void ToolExecutor::push(size_t queue, Job job)
+{
+	{
+		std::lock_guard<std::mutex> lock(queues_[queue]->mutex);
+		queues_[queue]->jobs.push_back(std::move(job));
+	}
+	queued_.fetch_add(1, std::memory_order_release);
+
+	// Taking the lock orders this against a worker checking queued_ before
+	// it sleeps, so the wakeup cannot be lost
+	{
+		std::lock_guard<std::mutex> lock(wake_mutex_);
+	}
+	wake_cv_.notify_one();
+}
+
+bool ToolExecutor::take(size_t self, Job &job)
+{
+	for (size_t i = 0; i < queues_.size(); ++i)
+	{
+		Queue &queue = *queues_[(self + i) % queues_.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.jobs.empty())
+			continue;
+
+		if (i == 0)
+		{
+			job = std::move(queue.jobs.front());
+			queue.jobs.pop_front();
+		}
+		else
+		{
+			job = std::move(queue.jobs.back());
+			queue.jobs.pop_back();
+		}
+		queued_.fetch_sub(1, std::memory_order_relaxed);
+		return true;
+	}
+	return false;
+}
+
+void ToolExecutor::run(size_t self, Job &job)
+{
+	// Timed out while queued: the caller already has its error
+	if (job.state->is_abandoned())
+		return;
+
+	ToolState &tool = *job.tool;
+	{
+		std::lock_guard<std::mutex> lock(tools_mutex_);
+		if (tool.limit.max_concurrent > 0 && tool.running >= tool.limit.max_concurrent)
+		{
+			// Requeued by the call that frees a slot
+			tool.waiting.push_back(std::move(job));
+			return;
+		}
+		tool.running++;
+	}
+
+	json result;
+	std::exception_ptr error;
+	try
+	{
+		result = job.call();
+	}
+	catch (...)
+	{
+		error = std::current_exception();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(job.state->mutex);
+		job.state->result = std::move(result);
+		job.state->error = error;
+		job.state->done = true;
+	}
+	job.state->cv.notify_all();
+
+	Job next;
+	bool has_next = false;
+	{
+		std::lock_guard<std::mutex> lock(tools_mutex_);
+		tool.running--;
+		while (!tool.waiting.empty() && !has_next)
+		{
+			next = std::move(tool.waiting.front());
+			tool.waiting.pop_front();
+			has_next = !next.state->is_abandoned();
+		}
+	}
+
+	if (has_next)
+		push(self, std::move(next));
+}
+
+std::map<std::string, ToolExecutor::ToolLoad> ToolExecutor::load() const
+{
+	std::lock_guard<std::mutex> lock(tools_mutex_);
+
+	std::map<std::string, ToolLoad> load;
+	for (const auto &[name, tool] : tools_)
+		load[name] = {tool->running, tool->waiting.size(), tool->timeouts.load(std::memory_order_relaxed)};
+	return load;
+}
+
+void ToolExecutor::worker_loop(size_t self)
+{
+	while (true)
+	{
+		Job job;
+		if (take(self, job))
+		{
+			run(self, job);
+			continue;
+		}
+
+		// Nothing queued anywhere. A call requeued later by a worker still
+		// running lands on that worker's own queue, so the others may go.
+		std::unique_lock<std::mutex> lock(wake_mutex_);
+		if (stopping_)
+			return;
+		wake_cv_.wait(lock, [this]()
+									{ return stopping_ || queued_.load(std::memory_order_acquire) > 0; });
+	}
+}
@@ -0,0 +1,202 @@
+#include "core/tool_grammar.h"
+#include <vector>
+
+// Generic JSON, for schemas (or parts of them) the builder does not model.
+// ws is llama.cpp's json.gbnf form, so calls may be pretty-printed, but two
+// ws never meet: a call cannot contain "\n\n", a default stop sequence.
+static const char *JSON_RULES = R"(value ::= object | array | string | number | boolean | null
+object ::= "{" ws ( string ws ":" ws value ( ws "," ws string ws ":" ws value )* ws )? "}"
+array ::= "[" ws ( value ( ws "," ws value )* ws )? "]"
+string ::= "\"" ( [^"\\\x7F\x00-\x1F] | "\\" ( ["\\/bfnrt] | "u" [0-9a-fA-F] [0-9a-fA-F] [0-9a-fA-F] [0-9a-fA-F] ) )* "\""
+number ::= integer ( "." [0-9]+ )? ( [eE] [-+]? [0-9]+ )?
+integer ::= "-"? ( "0" | [1-9] [0-9]* )
+boolean ::= "true" | "false"
+null ::= "null"
+ws ::= | " " | "\n" [ \t]{0,20}
+)";
+
+// GBNF literal matching exactly text
+static std::string literal(const std::string &text)
+{
+	std::string out = "\"";
+	for (char c : text)
+	{
+		switch (c)
+		{
+		case '"':
+			out += "\\\"";
+			break;
+		case '\\':
+			out += "\\\\";
+			break;
+		case '\n':
+			out += "\\n";
+			break;
+		case '\r':
+			out += "\\r";
+			break;
+		case '\t':
+			out += "\\t";
+			break;
+		default:
+			out += c;
+		}
+	}
+	return out + "\"";
+}
+
+namespace
+{
+	class RuleWriter
+	{
+	public:
+		std::string add(const std::string &name, const std::string &body)
+		{
+			rules_.push_back(name + " ::= " + body + "\n");
+			return name;
+		}
+
+		std::string str() const
+		{
+			std::string out;
+			for (const auto &rule : rules_)
+				out += rule;
+			return out;
+		}
+
+		// Rule for a value matching schema; name is used for any rules it needs
+		std::string schema(const json &schema, const std::string &name)
+		{
+			if (!schema.is_object())
+				return "value";
+
+			if (schema.contains("enum") && schema["enum"].is_array())
+			{
+				std::string body;
+				for (const auto &v : schema["enum"])
+					body += (body.empty() ? "" : " | ") + literal(v.dump());
+				return body.empty() ? "value" : add(name, body);
+			}
+
+			std::string type = schema.value("type", "");
+
+			if (type == "string" || type == "number" || type == "integer" ||
+					type == "boolean" || type == "null")
+				return type;
+
+			if (type == "array")
+			{
+				std::string item = this->schema(schema.value("items", json::object()), name + "-item");
+				return add(name, "\"[\" ws ( " + item + " ( ws \",\" ws " + item + " )* ws )? \"]\"");
+			}
+
+			if (type == "object" && schema.contains("properties") && schema["properties"].is_object())
+				return object(schema, name);
+
+			return type == "object" ? "object" : "value";
+		}
+
+	private:
+		std::vector<std::string> rules_;
+
+		// Required properties come first, then the optional ones in schema
+		// order, each of which may be left out
+		std::string object(const json &schema, const std::string &name)
+		{
+			const json &props = schema["properties"];
+			json required = schema.value("required", json::array());
+
+			auto is_required = [&](const std::string &key)
+			{
+				for (const auto &r : required)
+				{
+					if (r == key)
+						return true;
+				}
+				return false;
+			};
+
+			std::vector<std::string> required_kv;
+			std::vector<std::string> optional_kv;
+			int index = 0;
+
+			for (const auto &[key, prop] : props.items())
+			{
+				std::string value = this->schema(prop, name + "-" + std::to_string(index++));
+				std::string kv = literal(json(key).dump()) + " ws \":\" ws " + value;
+				(is_required(key) ? required_kv : optional_kv).push_back(kv);
+			}
+
+			std::string body;
+			for (const auto &kv : required_kv)
+				body += (body.empty() ? "" : " ws \",\" ws ") + kv;
+
+			if (!optional_kv.empty())
+			{
+				size_t n = optional_kv.size();
+
+				if (!required_kv.empty())
+				{
+					// Each optional one is preceded by a comma
+					for (const auto &kv : optional_kv)
+						body += " ( ws \",\" ws " + kv + " )?";
+				}
+				else
+				{
+					// first-i: optional i and any later ones, or only later ones
+					for (size_t i = n; i-- > 0;)
+					{
+						std::string rest;
+						for (size_t j = i + 1; j < n; ++j)
+							rest += " ( ws \",\" ws " + optional_kv[j] + " )?";
+
+						std::string rule = optional_kv[i] + rest;
+						if (i + 1 < n)
+							rule += " | " + name + "-first-" + std::to_string(i + 1);
+						add(name + "-first-" + std::to_string(i), rule);
+					}
+					// The closing ws goes inside, so an empty object has one
+					return add(name, "\"{\" ws ( " + name + "-first-0 ws )? \"}\"");
+				}
+			}
+
+			if (body.empty())
+				return add(name, "\"{\" ws \"}\"");
+			return add(name, "\"{\" ws " + body + " ws \"}\"");
+		}
+	};
+}
+
+std::string ToolGrammar::build(const json &tools)
+{
+	RuleWriter rules;
+	std::string calls;
+	int index = 0;
+
+	for (const auto &tool : tools)
+	{
+		const auto &fn = tool["function"];
+		std::string prefix = "tool-" + std::to_string(index++);
+
+		std::string args = rules.schema(fn.value("parameters", json::object()), prefix + "-args");
+		std::string call = rules.add(prefix,
+																 "\"{\" ws \"\\\"tool\\\"\" ws \":\" ws " +
+																		 literal(json(fn["name"].get<std::string>()).dump()) +
+																		 " ws \",\" ws \"\\\"arguments\\\"\" ws \":\" ws " + args + " ws \"}\"");
+
+		calls += (calls.empty() ? "" : " | ") + call;
+	}
+
+	std::string grammar;
+	if (calls.empty())
+		grammar = "root ::= answer\n";
+	else
+		grammar = "root ::= ws ( calls | answer )\n"
+							"calls ::= call | \"[\" ws call ( ws \",\" ws call )* ws \"]\"\n"
+							"call ::= " +
+							calls + "\n";
+
+	// Anything that does not open like a call is a direct answer
+	grammar += "answer ::= [^{[ \\t\\n] [^\\x00]*\n";
+	return grammar + rules.str() + JSON_RULES;
+}
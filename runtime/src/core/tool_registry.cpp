@@ -1,10 +1,13 @@
 #include "core/tool_registry.h"
 #include "tools/argument_validator.h"
 #include "core/error.h"
+#include "core/trace.h"
+#include <chrono>
 
 void ToolRegistry::register_tool(std::unique_ptr<Tool> tool)
 {
-	tools_[tool->name()] = std::move(tool);
+	std::string name = tool->name();
+	tools_[name] = {std::move(tool), std::make_unique<CallStats>()};
 }
 
 bool ToolRegistry::has(const std::string &name) const
@@ -25,11 +28,23 @@ json ToolRegistry::invoke(const std::string &name, json arguments) const
 											name)}};
 	}
 
-	auto &tool = it->second;
+	auto &tool = it->second.tool;
+	CallStats &stats = *it->second.stats;
 	const json &schema = tool->schema();
 
+	TraceSpan span("tool", "tools");
+	if (span.active())
+		span.arg("name", name);
+
+	auto start = std::chrono::steady_clock::now();
+	auto elapsed_ms = [start]()
+	{
+		return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	};
+
 	if (auto err = ArgumentValidator::validate(arguments, schema))
 	{
+		stats.record(elapsed_ms(), false);
 		return {
 				{"error", make_error(
 											ErrorCode::INVALID_ARGUMENT,
@@ -38,18 +53,37 @@ json ToolRegistry::invoke(const std::string &name, json arguments) const
 											name)}};
 	}
 
-	return tool->run(arguments);
+	try
+	{
+		json result = tool->run(arguments);
+		stats.record(elapsed_ms(), !(result.is_object() && result.contains("error")));
+		return result;
+	}
+	catch (...)
+	{
+		stats.record(elapsed_ms(), false);
+		throw;
+	}
 }
 
 json ToolRegistry::list() const
 {
 	json tools = json::array();
 
-	for (const auto &[_, tool] : tools_)
+	for (const auto &[_, entry] : tools_)
 	{
+		const auto &tool = entry.tool;
 		tools.push_back({{"type", "function"},
 										 {"function", {{"name", tool->name()}, {"description", tool->description()}, {"parameters", tool->schema()}}}});
 	}
 
 	return tools;
 }
+
+std::vector<std::pair<std::string, const CallStats *>> ToolRegistry::call_stats() const
+{
+	std::vector<std::pair<std::string, const CallStats *>> stats;
+	for (const auto &[name, entry] : tools_)
+		stats.emplace_back(name, entry.stats.get());
+	return stats;
+}
@@ -0,0 +1,150 @@
+#include "core/trace.h"
+#include "core/logger.h"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+
+static thread_local Trace *current_trace = nullptr;
+
+static double micros(Trace::Clock::duration d)
+{
+	return std::chrono::duration<double, std::micro>(d).count();
+}
+
+Trace::Trace(uint64_t id, std::string path, Clock::time_point start)
+		: id_(id), path_(std::move(path)), start_(start)
+{
+}
+
+void Trace::add(const char *name, const char *category, Clock::time_point start, Clock::time_point end, json args)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	events_.push_back({name, category, start, end, thread_number(), std::move(args)});
+}
+
+json Trace::to_json() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	// Spans can start before the request did (the socket read)
+	Clock::time_point origin = start_;
+	for (const auto &event : events_)
+		origin = std::min(origin, event.start);
+
+	json events = json::array();
+	for (const auto &event : events_)
+	{
+		json e = {
+				{"name", event.name},
+				{"cat", event.category},
+				{"ph", "X"},
+				{"ts", micros(event.start - origin)},
+				{"dur", micros(event.end - event.start)},
+				{"pid", 1},
+				{"tid", event.thread}};
+		if (!event.args.is_null())
+			e["args"] = event.args;
+		events.push_back(std::move(e));
+	}
+
+	return {
+			{"traceEvents", events},
+			{"displayTimeUnit", "ms"},
+			{"otherData", {{"trace_id", id_}}}};
+}
+
+Trace *Trace::current()
+{
+	return current_trace;
+}
+
+TraceScope::TraceScope(std::shared_ptr<Trace> trace)
+		: trace_(std::move(trace)), previous_(current_trace)
+{
+	current_trace = trace_.get();
+}
+
+TraceScope::~TraceScope()
+{
+	current_trace = previous_;
+}
+
+TraceSpan::TraceSpan(const char *name, const char *category)
+		: trace_(current_trace), name_(name), category_(category)
+{
+	if (trace_)
+		start_ = Trace::Clock::now();
+}
+
+TraceSpan::~TraceSpan()
+{
+	if (trace_)
+		trace_->add(name_, category_, start_, Trace::Clock::now(), std::move(args_));
+}
+
+void TraceSpan::arg(const char *key, json value)
+{
+	if (trace_)
+		args_[key] = std::move(value);
+}
+
+Tracer &Tracer::instance()
+{
+	static Tracer tracer;
+	return tracer;
+}
+
+void Tracer::configure(const std::string &dir, double sample_rate)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		dir_ = dir;
+	}
+
+	uint64_t every = 0;
+	if (sample_rate > 0)
+		every = static_cast<uint64_t>(std::max(1.0, std::round(1.0 / std::min(sample_rate, 1.0))));
+	sample_every_.store(every, std::memory_order_relaxed);
+}
+
+std::shared_ptr<Trace> Tracer::begin(const json &request, Trace::Clock::time_point start)
+{
+	bool asked = request.is_object() && request.contains("trace") && request["trace"].is_boolean() && request["trace"].get<bool>();
+
+	uint64_t every = sample_every_.load(std::memory_order_relaxed);
+	bool sampled = every > 0 && requests_.fetch_add(1, std::memory_order_relaxed) % every == 0;
+
+	if (!asked && !sampled)
+		return nullptr;
+
+	uint64_t id = next_id_.fetch_add(1, std::memory_order_relaxed);
+	auto wall = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+	std::string dir;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		dir = dir_;
+	}
+
+	std::string path = (std::filesystem::path(dir) / ("trace-" + std::to_string(wall) + "-" + std::to_string(id) + ".json")).string();
+	return std::make_shared<Trace>(id, std::move(path), start);
+}
+
+void Tracer::finish(Trace &trace)
+{
+	trace.add("request", "ipc", trace.start(), Trace::Clock::now());
+
+	std::filesystem::path path(trace.path());
+	std::error_code ec;
+	if (path.has_parent_path())
+		std::filesystem::create_directories(path.parent_path(), ec);
+
+	std::ofstream file(path);
+	if (!file.is_open())
+	{
+		LOG_WARN("trace", "Cannot write " << trace.path());
+		return;
+	}
+	file << trace.to_json().dump();
+}
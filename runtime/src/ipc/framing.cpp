@@ -0,0 +1,191 @@
+#include "ipc/framing.h"
+
+#include <algorithm>
+#include <cstring>
+
+static constexpr size_t LENGTH_HEADER = 4;
+
+// Most a frame's header alone can make prepare() reserve; larger frames
+// grow the buffer as their bytes actually arrive
+static constexpr size_t MAX_RESERVE = 1 << 20;
+
+static bool is_json_start(char c)
+{
+	return c == '{' || c == '[' || c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+char *FrameReader::prepare(size_t min_size)
+{
+	if (start_ == end_)
+	{
+		// Everything consumed: rewind without moving any bytes
+		start_ = scan_ = end_ = 0;
+	}
+
+	// A length-prefixed frame announces its size, so reserve it now instead
+	// of growing once per read. The header is untrusted, hence the cap.
+	if (mode_ == FrameMode::LENGTH_PREFIXED && buffered() >= LENGTH_HEADER)
+	{
+		const auto *h = reinterpret_cast<const unsigned char *>(buffer_.data() + start_);
+		size_t len = (size_t(h[0]) << 24) | (size_t(h[1]) << 16) | (size_t(h[2]) << 8) | size_t(h[3]);
+		size_t frame_size = LENGTH_HEADER + len;
+		if (frame_size > buffered())
+			min_size = std::max(min_size, std::min(frame_size - buffered(), MAX_RESERVE));
+	}
+
+	if (writable() < min_size && start_ > 0)
+	{
+		// Only the tail of an unfinished frame is moved
+		size_t pending = end_ - start_;
+		std::memmove(buffer_.data(), buffer_.data() + start_, pending);
+		scan_ -= start_;
+		end_ = pending;
+		start_ = 0;
+	}
+
+	if (writable() < min_size)
+	{
+		buffer_.resize(std::max(buffer_.size() * 2, end_ + min_size));
+	}
+
+	return buffer_.data() + end_;
+}
+
+bool FrameReader::next(std::string_view &frame)
+{
+	if (mode_ == FrameMode::UNKNOWN)
+	{
+		if (buffered() == 0)
+			return false;
+		mode_ = is_json_start(buffer_[start_]) ? FrameMode::JSON : FrameMode::LENGTH_PREFIXED;
+	}
+
+	if (mode_ == FrameMode::JSON)
+		return next_json(frame);
+	return next_length_prefixed(frame);
+}
+
+bool FrameReader::next_json(std::string_view &frame)
+{
+	const char *data = buffer_.data();
+
+	for (; scan_ < end_; ++scan_)
+	{
+		char c = data[scan_];
+
+		if (in_string_)
+		{
+			if (escape_)
+				escape_ = false;
+			else if (c == '\\')
+				escape_ = true;
+			else if (c == '"')
+				in_string_ = false;
+			continue;
+		}
+
+		switch (c)
+		{
+		case '"':
+			in_string_ = true;
+			seen_value_ = true;
+			break;
+		case '{':
+		case '[':
+			++depth_;
+			seen_value_ = true;
+			break;
+		case '}':
+		case ']':
+			if (--depth_ <= 0)
+			{
+				// Top-level value closed: frame ends here, newline or not
+				frame = std::string_view(data + start_, scan_ + 1 - start_);
+				start_ = ++scan_;
+				reset_scanner();
+				return true;
+			}
+			break;
+		case ' ':
+		case '\t':
+		case '\r':
+		case '\n':
+			if (depth_ == 0)
+			{
+				if (seen_value_ && c == '\n')
+				{
+					// Bare scalar or garbage line; let the parser report it
+					frame = std::string_view(data + start_, scan_ - start_);
+					start_ = ++scan_;
+					reset_scanner();
+					return true;
+				}
+				if (!seen_value_)
+					start_ = scan_ + 1;
+			}
+			break;
+		default:
+			seen_value_ = true;
+			break;
+		}
+	}
+
+	return false;
+}
+
+bool FrameReader::next_length_prefixed(std::string_view &frame)
+{
+	if (buffered() < LENGTH_HEADER)
+		return false;
+
+	const auto *h = reinterpret_cast<const unsigned char *>(buffer_.data() + start_);
+	size_t len = (size_t(h[0]) << 24) | (size_t(h[1]) << 16) | (size_t(h[2]) << 8) | size_t(h[3]);
+
+	if (buffered() < LENGTH_HEADER + len)
+		return false;
+
+	frame = std::string_view(buffer_.data() + start_ + LENGTH_HEADER, len);
+	start_ += LENGTH_HEADER + len;
+	scan_ = start_;
+	return true;
+}
+
+bool FrameReader::finish(std::string_view &frame)
+{
+	if (buffered() == 0)
+		return false;
+	if (mode_ == FrameMode::JSON && !seen_value_)
+		return false;
+
+	frame = std::string_view(buffer_.data() + start_, end_ - start_);
+	start_ = scan_ = end_;
+	reset_scanner();
+	return true;
+}
+
+void FrameReader::reset_scanner()
+{
+	depth_ = 0;
+	in_string_ = false;
+	escape_ = false;
+	seen_value_ = false;
+}
+
+void append_frame(std::string &out, FrameMode mode, const std::string &payload)
+{
+	if (mode == FrameMode::LENGTH_PREFIXED)
+	{
+		uint32_t len = static_cast<uint32_t>(payload.size());
+		char header[LENGTH_HEADER] = {
+				static_cast<char>((len >> 24) & 0xff),
+				static_cast<char>((len >> 16) & 0xff),
+				static_cast<char>((len >> 8) & 0xff),
+				static_cast<char>(len & 0xff)};
+		out.append(header, LENGTH_HEADER);
+		out.append(payload);
+		return;
+	}
+
+	out.append(payload);
+	out.push_back('\n');
+}
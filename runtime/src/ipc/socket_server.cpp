@@ -1,34 +1,136 @@
 #include "ipc/socket_server.h"
+#include "core/logger.h"
+#include "core/trace.h"
 
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
 #include <signal.h>
+#include <cerrno>
 #include <cstring>
-#include <iostream>
 
-SocketServer::SocketServer(const std::string &socket_path, ActionDispatcher &dispatcher)
-		: socket_path_(socket_path), server_fd_(-1), dispatcher_(dispatcher)
+// epoll user data for the two non-client descriptors; client ids start above
+static constexpr uint64_t LISTEN_ID = 0;
+static constexpr uint64_t WAKE_ID = 1;
+
+static constexpr size_t READ_CHUNK = 16384;
+static constexpr int MAX_EVENTS = 256;
+
+// Pipelined requests one client may have running before we stop reading
+// from it; the rest wait in its receive buffer.
+static constexpr int MAX_IN_FLIGHT = 64;
+
+SocketServer::SocketServer(const std::string &socket_path, ActionDispatcher &dispatcher, int n_workers)
+		: socket_path_(socket_path),
+			server_fd_(-1),
+			epoll_fd_(-1),
+			wake_fd_(-1),
+			dispatcher_(dispatcher),
+			n_workers_(n_workers > 0 ? n_workers : 1),
+			next_conn_id_(2)
 {
 }
 
 SocketServer::~SocketServer()
 {
+	// Join workers first so none of them posts into a half-destroyed server
+	dispatcher_.set_worker_pool(nullptr);
+	workers_.reset();
+
+	for (auto &[_, conn] : connections_)
+		close(conn.fd);
+	connections_.clear();
+
+	if (wake_fd_ >= 0)
+		close(wake_fd_);
+	if (epoll_fd_ >= 0)
+		close(epoll_fd_);
 	if (server_fd_ >= 0)
 		close(server_fd_);
 	unlink(socket_path_.c_str());
 }
 
-void SocketServer::run()
+static void raise_fd_limit()
 {
-	// Ignore SIGPIPE - handle write errors instead
-	signal(SIGPIPE, SIG_IGN);
+	// Each client holds one descriptor; lift the soft limit so thousands
+	// of concurrent connections don't hit EMFILE.
+	rlimit lim{};
+	if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max)
+	{
+		lim.rlim_cur = lim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &lim);
+	}
+}
+
+static void log_response(const json &response, const std::string &out)
+{
+	if (response.contains("status") && response["status"] == "ok")
+	{
+		LOG_DEBUG("response", "OK (" << out.length() << " bytes)");
+	}
+	else
+	{
+		LOG_WARN("response", "ERROR " << Logger::instance().excerpt(out));
+	}
+}
+
+static void log_errno(const char *what)
+{
+	LOG_ERROR("SocketServer", what << ": " << std::strerror(errno));
+}
+
+// Dispatch with a last-resort guard so a throwing handler still answers
+static json safe_dispatch(ActionDispatcher &dispatcher, const json &request, const FrameSink &emit = nullptr)
+{
+	try
+	{
+		return dispatcher.dispatch(request, emit);
+	}
+	catch (const std::exception &e)
+	{
+		json response = {
+				{"status", "error"},
+				{"error", std::string("internal error: ") + e.what()}};
+		if (request.is_object() && request.contains("id"))
+			response["id"] = request["id"];
+		return response;
+	}
+}
 
-	server_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+// Runs a request with its trace (if any) current and serializes the
+// answer; a traced response names its trace file, written once the
+// response is ready to go out
+static std::string answer(ActionDispatcher &dispatcher, const json &request, const std::shared_ptr<Trace> &trace, const FrameSink &emit = nullptr)
+{
+	TraceScope scope(trace);
+
+	json response = safe_dispatch(dispatcher, request, emit);
+	if (trace)
+		response["trace_file"] = trace->path();
+
+	std::string out;
+	{
+		TraceSpan span("serialize", "ipc");
+		out = response.dump();
+		span.arg("bytes", out.size());
+	}
+	log_response(response, out);
+
+	if (trace)
+		Tracer::instance().finish(*trace);
+	return out;
+}
+
+bool SocketServer::setup_socket()
+{
+	server_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 	if (server_fd_ < 0)
 	{
-		perror("socket");
-		return;
+		log_errno("socket");
+		return false;
 	}
 
 	sockaddr_un addr{};
@@ -39,83 +141,376 @@ void SocketServer::run()
 
 	if (bind(server_fd_, (sockaddr *)&addr, sizeof(addr)) < 0)
 	{
-		perror("bind");
-		return;
+		log_errno("bind");
+		return false;
 	}
 
-	if (listen(server_fd_, 1) < 0)
+	if (listen(server_fd_, SOMAXCONN) < 0)
 	{
-		perror("listen");
-		return;
+		log_errno("listen");
+		return false;
+	}
+
+	epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd_ < 0)
+	{
+		log_errno("epoll_create1");
+		return false;
+	}
+
+	wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wake_fd_ < 0)
+	{
+		log_errno("eventfd");
+		return false;
+	}
+
+	epoll_event ev{};
+	ev.events = EPOLLIN;
+	ev.data.u64 = LISTEN_ID;
+	if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, server_fd_, &ev) < 0)
+	{
+		log_errno("epoll_ctl");
+		return false;
+	}
+
+	ev.data.u64 = WAKE_ID;
+	if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev) < 0)
+	{
+		log_errno("epoll_ctl");
+		return false;
 	}
 
-	std::cout << "[forge-runtime] listening on " << socket_path_ << "\n";
+	return true;
+}
+
+void SocketServer::run()
+{
+	// Ignore SIGPIPE - handle write errors instead
+	signal(SIGPIPE, SIG_IGN);
+
+	raise_fd_limit();
+
+	if (!setup_socket())
+		return;
+
+	workers_ = std::make_unique<ThreadPool>(n_workers_);
+	dispatcher_.set_worker_pool(workers_.get());
+
+	LOG_INFO("forge-runtime", "listening on " << socket_path_
+						<< " (" << n_workers_ << " workers)");
+
+	epoll_event events[MAX_EVENTS];
+
+	while (true)
+	{
+		int n = epoll_wait(epoll_fd_, events, MAX_EVENTS, -1);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			log_errno("epoll_wait");
+			return;
+		}
+
+		for (int i = 0; i < n; ++i)
+		{
+			uint64_t id = events[i].data.u64;
+			uint32_t flags = events[i].events;
+
+			if (id == LISTEN_ID)
+			{
+				accept_clients();
+				continue;
+			}
+
+			if (id == WAKE_ID)
+			{
+				drain_completions();
+				continue;
+			}
+
+			auto it = connections_.find(id);
+			if (it == connections_.end())
+				continue;
 
+			// HUP means the peer closed both directions; nothing in flight can
+			// be delivered any more. A half-close only shows up as EOF on read.
+			if (flags & (EPOLLHUP | EPOLLERR))
+			{
+				close_connection(id);
+				continue;
+			}
+
+			if (flags & EPOLLIN)
+				handle_readable(id, it->second);
+			if (flags & EPOLLOUT)
+				handle_writable(it->second);
+
+			settle(id, it->second);
+		}
+	}
+}
+
+void SocketServer::accept_clients()
+{
 	while (true)
 	{
-		int client_fd = accept(server_fd_, nullptr, nullptr);
+		int client_fd = accept4(server_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
 		if (client_fd < 0)
 		{
-			perror("accept");
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				log_errno("accept");
+			return;
+		}
+
+		uint64_t id = next_conn_id_++;
+
+		epoll_event ev{};
+		ev.events = EPOLLIN;
+		ev.data.u64 = id;
+		if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, client_fd, &ev) < 0)
+		{
+			log_errno("epoll_ctl");
+			close(client_fd);
 			continue;
 		}
 
-		handle_client(client_fd);
-		close(client_fd);
+		Connection conn;
+		conn.fd = client_fd;
+		conn.events = EPOLLIN;
+		connections_.emplace(id, std::move(conn));
 	}
 }
 
-void SocketServer::handle_client(int client_fd)
+void SocketServer::handle_readable(uint64_t conn_id, Connection &conn)
 {
-	char buffer[8192]; // Increased buffer size
-	ssize_t n = read(client_fd, buffer, sizeof(buffer) - 1);
-	if (n <= 0)
-		return;
+	while (!conn.read_closed && !conn.broken && conn.in_flight < MAX_IN_FLIGHT)
+	{
+		// A new request starts arriving
+		if (conn.reader.buffered() == 0)
+			conn.read_started = std::chrono::steady_clock::now();
+
+		// Read straight into the frame buffer; it grows as large as the
+		// request needs
+		char *buf = conn.reader.prepare(READ_CHUNK);
+		ssize_t n = read(conn.fd, buf, conn.reader.writable());
+
+		if (n > 0)
+		{
+			conn.reader.commit(n);
+			dispatch_frames(conn_id, conn);
+			continue;
+		}
+
+		if (n == 0)
+		{
+			conn.read_closed = true;
+			dispatch_frames(conn_id, conn);
+			break;
+		}
+
+		if (errno == EINTR)
+			continue;
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			break;
+
+		log_errno("read");
+		conn.broken = true;
+	}
+}
+
+void SocketServer::dispatch_frames(uint64_t conn_id, Connection &conn)
+{
+	std::string_view frame;
+
+	while (!conn.broken && conn.in_flight < MAX_IN_FLIGHT)
+	{
+		if (conn.reader.next(frame))
+		{
+			dispatch_request(conn_id, conn, frame);
+			continue;
+		}
 
-	buffer[n] = '\0';
+		// Client stopped sending mid-frame: hand over what arrived so the
+		// parse error gets reported
+		if (conn.read_closed && conn.reader.finish(frame))
+			dispatch_request(conn_id, conn, frame);
 
-	std::cout << "[request raw]\n"
-						<< buffer << "\n";
+		break;
+	}
+}
 
-	json response;
+void SocketServer::dispatch_request(uint64_t conn_id, Connection &conn, std::string_view frame)
+{
+	// Bodies can be megabytes; only a bounded excerpt, and only when asked
+	LOG_DEBUG("request", Logger::instance().excerpt(frame));
+
+	json request;
+	auto parse_start = std::chrono::steady_clock::now();
 
 	try
 	{
-		json request = json::parse(buffer);
-		response = dispatcher_.dispatch(request);
+		request = json::parse(frame.begin(), frame.end());
 	}
 	catch (const std::exception &e)
 	{
-		response = {
+		json response = {
 				{"status", "error"},
 				{"error", std::string("invalid json: ") + e.what()}};
+		std::string out = response.dump();
+		log_response(response, out);
+		queue_response(conn, out);
+		return;
+	}
+
+	std::shared_ptr<Trace> trace = Tracer::instance().begin(request, conn.read_started);
+	if (trace)
+	{
+		trace->add("read", "ipc", conn.read_started, parse_start);
+		trace->add("parse", "ipc", parse_start, std::chrono::steady_clock::now(), {{"bytes", frame.size()}});
+	}
+
+	if (!dispatcher_.is_long_running(request))
+	{
+		// Cheap actions are answered straight from the event loop
+		queue_response(conn, answer(dispatcher_, request, trace));
+		return;
 	}
 
-	std::string out = response.dump();
+	conn.in_flight++;
+
+	auto alive = conn.alive;
+	auto queued = std::chrono::steady_clock::now();
+	workers_->submit([this, conn_id, alive, queued, trace, request = std::move(request)]()
+									 {
+		if (trace)
+			trace->add("worker queue", "ipc", queued, std::chrono::steady_clock::now());
 
-	// Write response with proper error handling
-	size_t total_written = 0;
-	while (total_written < out.size())
+		FrameSink emit = [this, conn_id, &alive](const json &frame) {
+			if (!alive->load(std::memory_order_relaxed))
+				return false;
+			post_response(conn_id, frame.dump(), false);
+			return true;
+		};
+
+		post_response(conn_id, answer(dispatcher_, request, trace, emit), true); });
+}
+
+void SocketServer::post_response(uint64_t conn_id, std::string payload, bool final)
+{
 	{
-		ssize_t written = write(client_fd, out.c_str() + total_written, out.size() - total_written);
-		if (written < 0)
+		std::lock_guard<std::mutex> lock(completions_mutex_);
+		completions_.push_back({conn_id, std::move(payload), final});
+	}
+
+	uint64_t one = 1;
+	if (write(wake_fd_, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		log_errno("eventfd write");
+}
+
+void SocketServer::drain_completions()
+{
+	uint64_t counter;
+	while (read(wake_fd_, &counter, sizeof(counter)) > 0)
+	{
+	}
+
+	std::vector<Completion> ready;
+	{
+		std::lock_guard<std::mutex> lock(completions_mutex_);
+		ready.swap(completions_);
+	}
+
+	for (auto &completion : ready)
+	{
+		auto it = connections_.find(completion.conn_id);
+		if (it == connections_.end())
+			continue; // Client went away while the request was running
+
+		Connection &conn = it->second;
+		queue_response(conn, completion.payload);
+
+		if (completion.final)
 		{
-			perror("write");
-			return;
+			conn.in_flight--;
+
+			// Requests parked behind MAX_IN_FLIGHT can start now
+			dispatch_frames(completion.conn_id, conn);
 		}
-		total_written += written;
+
+		settle(completion.conn_id, conn);
 	}
+}
 
-	// Flush to ensure data is sent
-	fsync(client_fd);
+void SocketServer::queue_response(Connection &conn, const std::string &payload)
+{
+	append_frame(conn.out, conn.reader.mode(), payload);
+	handle_writable(conn);
+}
 
-	if (response.contains("status") && response["status"] == "ok")
+void SocketServer::handle_writable(Connection &conn)
+{
+	while (!conn.broken && conn.out_offset < conn.out.size())
 	{
-		std::cout << "[response] OK (" << out.length() << " bytes)\n";
+		ssize_t written = write(conn.fd, conn.out.data() + conn.out_offset, conn.out.size() - conn.out_offset);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return; // settle() arms EPOLLOUT
+
+			log_errno("write");
+			conn.broken = true;
+			return;
+		}
+		conn.out_offset += written;
 	}
-	else
+
+	conn.out.clear();
+	conn.out_offset = 0;
+}
+
+void SocketServer::settle(uint64_t conn_id, Connection &conn)
+{
+	bool flushed = conn.out_offset >= conn.out.size();
+
+	// Connections stay open for further requests until the client is done
+	// sending and every response has been written
+	if (conn.broken || (conn.read_closed && conn.in_flight == 0 && flushed))
 	{
-		std::cout << "[response] ERROR\n"
-							<< out << "\n";
+		close_connection(conn_id);
+		return;
 	}
+
+	uint32_t events = 0;
+	if (!conn.read_closed && conn.in_flight < MAX_IN_FLIGHT)
+		events |= EPOLLIN;
+	if (!flushed)
+		events |= EPOLLOUT;
+
+	if (events == conn.events)
+		return;
+
+	epoll_event ev{};
+	ev.events = events;
+	ev.data.u64 = conn_id;
+	if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, conn.fd, &ev) < 0)
+		log_errno("epoll_ctl");
+	conn.events = events;
+}
+
+void SocketServer::close_connection(uint64_t conn_id)
+{
+	auto it = connections_.find(conn_id);
+	if (it == connections_.end())
+		return;
+
+	it->second.alive->store(false, std::memory_order_relaxed);
+	epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, it->second.fd, nullptr);
+	close(it->second.fd);
+	connections_.erase(it);
 }
@@ -0,0 +1,275 @@
+#include "llm/autotuner.h"
+#include "core/logger.h"
+#include "llama.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <thread>
+#include <vector>
+
+using json = nlohmann::json;
+
+// Probe sizes: enough tokens for a stable rate, few enough that the
+// whole tuning run takes seconds to a minute on a small model
+static constexpr int DECODE_CONTEXT = 64;
+static constexpr int DECODE_TOKENS = 16;
+static constexpr int PREFILL_TOKENS = 512;
+static constexpr int UBATCH_SIZES[] = {64, 128, 256, 512};
+
+// A sweep stops once throughput falls this far below the best so far
+static constexpr float PAST_PEAK = 0.95f;
+
+static std::string cpu_model()
+{
+	std::ifstream cpuinfo("/proc/cpuinfo");
+	std::string line;
+	while (std::getline(cpuinfo, line))
+	{
+		if (line.rfind("model name", 0) != 0)
+			continue;
+
+		size_t start = line.find(':');
+		if (start == std::string::npos)
+			break;
+		start = line.find_first_not_of(" \t", start + 1);
+		return start == std::string::npos ? "unknown" : line.substr(start);
+	}
+	return "unknown";
+}
+
+// 1, 2, 3, 4, 6, 8, 12, 16, 24, ... up to max, and max itself
+static std::vector<int> thread_counts(int max)
+{
+	std::vector<int> counts;
+	for (int n = 1; n < max; n = n < 4 ? n + 1 : n % 3 == 0 ? n * 4 / 3 : n * 3 / 2)
+		counts.push_back(n);
+	counts.push_back(max);
+	return counts;
+}
+
+static float seconds_since(std::chrono::steady_clock::time_point t)
+{
+	return std::chrono::duration<float>(std::chrono::steady_clock::now() - t).count();
+}
+
+static llama_context *scratch_context(llama_model *model, const LlamaConfig &config, int n_ubatch)
+{
+	llama_context_params params = llama_context_default_params();
+	params.n_ctx = PREFILL_TOKENS + DECODE_CONTEXT + DECODE_TOKENS;
+	params.n_batch = PREFILL_TOKENS;
+	params.n_ubatch = n_ubatch;
+	params.n_seq_max = 1;
+	params.flash_attn = config.flash_attn;
+	return llama_new_context_with_model(model, params);
+}
+
+// Best of two runs, in tokens per second; 0 if decoding failed
+static float decode_rate(llama_context *ctx, std::vector<llama_token> &tokens)
+{
+	float best = 0.0f;
+	for (int run = 0; run < 2; ++run)
+	{
+		llama_kv_cache_clear(ctx);
+
+		// Some context first, so each step has attention to do
+		if (llama_decode(ctx, llama_batch_get_one(tokens.data(), DECODE_CONTEXT)) != 0)
+			return 0.0f;
+
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < DECODE_TOKENS; ++i)
+		{
+			if (llama_decode(ctx, llama_batch_get_one(&tokens[DECODE_CONTEXT + i], 1)) != 0)
+				return 0.0f;
+		}
+		best = std::max(best, DECODE_TOKENS / seconds_since(start));
+	}
+	return best;
+}
+
+static float prefill_rate(llama_context *ctx, std::vector<llama_token> &tokens)
+{
+	float best = 0.0f;
+	for (int run = 0; run < 2; ++run)
+	{
+		llama_kv_cache_clear(ctx);
+
+		auto start = std::chrono::steady_clock::now();
+		if (llama_decode(ctx, llama_batch_get_one(tokens.data(), PREFILL_TOKENS)) != 0)
+			return 0.0f;
+		best = std::max(best, PREFILL_TOKENS / seconds_since(start));
+	}
+	return best;
+}
+
+// Raises the thread count until the rate stops improving; returns the
+// best count and its rate
+template <typename Probe>
+static std::pair<int, float> sweep_threads(const std::vector<int> &counts, Probe &&probe)
+{
+	int best = counts.front();
+	float best_rate = 0.0f;
+
+	for (int n : counts)
+	{
+		float rate = probe(n);
+		if (rate > best_rate)
+		{
+			best = n;
+			best_rate = rate;
+		}
+		else if (rate < best_rate * PAST_PEAK)
+		{
+			break;
+		}
+	}
+
+	return {best, best_rate};
+}
+
+static json read_cache(const std::string &path)
+{
+	std::ifstream file(path);
+	if (!file.is_open())
+		return json::object();
+
+	try
+	{
+		json j;
+		file >> j;
+		if (j.is_object())
+			return j;
+	}
+	catch (const std::exception &)
+	{
+		LOG_WARN("LlamaEngine", "Ignoring unreadable autotune cache " << path);
+	}
+	return json::object();
+}
+
+bool autotune(llama_model *model, const LlamaConfig &config, uint64_t model_hash, TuneResult &result)
+{
+	int n_contexts = std::max(1, config.n_contexts);
+	int max_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()) / n_contexts);
+
+	char hash[17];
+	std::snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(model_hash));
+	std::string key = cpu_model() + "|" + std::to_string(std::thread::hardware_concurrency()) + " threads|" +
+										std::to_string(n_contexts) + " contexts|" + hash;
+
+	json cache = config.autotune_cache.empty() ? json::object() : read_cache(config.autotune_cache);
+	if (cache.contains(key))
+	{
+		const json &entry = cache[key];
+		result.n_threads = entry.value("n_threads", 0);
+		result.n_threads_batch = entry.value("n_threads_batch", 0);
+		result.n_ubatch = entry.value("n_ubatch", 0);
+		result.decode_tps = entry.value("decode_tps", 0.0f);
+		result.prefill_tps = entry.value("prefill_tps", 0.0f);
+		result.cached = true;
+
+		if (result.n_threads > 0 && result.n_threads_batch > 0 && result.n_ubatch > 0)
+			return true;
+	}
+
+	LOG_INFO("LlamaEngine", "Autotuning up to " << max_threads << " threads per context...");
+	auto start = std::chrono::steady_clock::now();
+
+	// Any valid ids do; the rates do not depend on what the tokens are
+	int n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(model));
+	std::vector<llama_token> tokens(PREFILL_TOKENS + DECODE_CONTEXT + DECODE_TOKENS);
+	for (size_t i = 0; i < tokens.size(); ++i)
+		tokens[i] = static_cast<llama_token>((i * 7919 + 13) % n_vocab);
+
+	std::vector<int> counts = thread_counts(max_threads);
+
+	// Decode and prefill threads on one context; the first call also warms
+	// up the weights, so it is not timed
+	int default_ubatch = std::clamp(config.n_ubatch, UBATCH_SIZES[0], PREFILL_TOKENS);
+	llama_context *ctx = scratch_context(model, config, default_ubatch);
+	if (!ctx)
+	{
+		LOG_ERROR("LlamaEngine", "Autotune: cannot create a context");
+		return false;
+	}
+	llama_decode(ctx, llama_batch_get_one(tokens.data(), 1));
+
+	auto decode = sweep_threads(counts, [&](int n)
+															{
+		llama_set_n_threads(ctx, n, n);
+		float rate = decode_rate(ctx, tokens);
+		LOG_DEBUG("LlamaEngine", "Autotune: decode " << n << " threads: " << rate << " t/s");
+		return rate; });
+
+	auto prefill = sweep_threads(counts, [&](int n)
+															 {
+		llama_set_n_threads(ctx, decode.first, n);
+		float rate = prefill_rate(ctx, tokens);
+		LOG_DEBUG("LlamaEngine", "Autotune: prefill " << n << " threads, ubatch " << default_ubatch << ": " << rate << " t/s");
+		return rate; });
+
+	llama_free(ctx);
+
+	// n_ubatch is fixed per context, so each size needs its own
+	int best_ubatch = default_ubatch;
+	float best_prefill = prefill.second;
+	for (int n_ubatch : UBATCH_SIZES)
+	{
+		if (n_ubatch == default_ubatch)
+			continue;
+
+		ctx = scratch_context(model, config, n_ubatch);
+		if (!ctx)
+			continue;
+		llama_set_n_threads(ctx, decode.first, prefill.first);
+
+		float rate = prefill_rate(ctx, tokens);
+		LOG_DEBUG("LlamaEngine", "Autotune: prefill " << prefill.first << " threads, ubatch " << n_ubatch << ": " << rate << " t/s");
+		if (rate > best_prefill)
+		{
+			best_ubatch = n_ubatch;
+			best_prefill = rate;
+		}
+		llama_free(ctx);
+	}
+
+	if (decode.second <= 0.0f || best_prefill <= 0.0f)
+	{
+		LOG_ERROR("LlamaEngine", "Autotune: probes failed");
+		return false;
+	}
+
+	result.n_threads = decode.first;
+	result.n_threads_batch = prefill.first;
+	result.n_ubatch = best_ubatch;
+	result.decode_tps = decode.second;
+	result.prefill_tps = best_prefill;
+	result.cached = false;
+
+	LOG_INFO("LlamaEngine", "Autotune took " << seconds_since(start) << " s");
+
+	if (!config.autotune_cache.empty())
+	{
+		cache[key] = {
+				{"n_threads", result.n_threads},
+				{"n_threads_batch", result.n_threads_batch},
+				{"n_ubatch", result.n_ubatch},
+				{"decode_tps", result.decode_tps},
+				{"prefill_tps", result.prefill_tps}};
+
+		std::error_code ec;
+		std::filesystem::path path(config.autotune_cache);
+		if (path.has_parent_path())
+			std::filesystem::create_directories(path.parent_path(), ec);
+
+		std::ofstream file(config.autotune_cache);
+		if (file.is_open())
+			file << cache.dump(2);
+		else
+			LOG_WARN("LlamaEngine", "Cannot write " << config.autotune_cache);
+	}
+
+	return true;
+}
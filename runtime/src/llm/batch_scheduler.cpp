@@ -0,0 +1,1202 @@
+#include "llm/batch_scheduler.h"
+#include "core/logger.h"
+#include "llm/batch_util.h"
+#include "llm/memory_planner.h"
+#include "llm/prompt_lookup.h"
+#include "llama.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+void GenerationTask::finish()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		done_ = true;
+	}
+	cv_.notify_all();
+}
+
+void GenerationTask::wait()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	cv_.wait(lock, [this]()
+					 { return done_; });
+}
+
+static float ms_since(std::chrono::steady_clock::time_point t)
+{
+	return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - t).count();
+}
+
+// Length of the longest prefix of text[0, end) that does not end inside a
+// multi-byte UTF-8 sequence. Tokens can split characters, and a partial
+// character is not valid JSON string content.
+static size_t utf8_complete_length(const std::string &text, size_t end)
+{
+	// Walk back over at most three continuation bytes to the lead byte
+	size_t lead = end;
+	while (lead > 0 && end - lead < 4)
+	{
+		unsigned char c = text[lead - 1];
+		--lead;
+		if ((c & 0xC0) != 0x80)
+		{
+			size_t need = 1;
+			if ((c & 0xE0) == 0xC0)
+				need = 2;
+			else if ((c & 0xF0) == 0xE0)
+				need = 3;
+			else if ((c & 0xF8) == 0xF0)
+				need = 4;
+
+			return end - lead >= need ? end : lead;
+		}
+	}
+
+	return end;
+}
+
+BatchScheduler::BatchScheduler(llama_model *model, const LlamaConfig &config)
+		: model_(model),
+			config_(config),
+			ctx_(nullptr),
+			n_ctx_slot_(config.n_ctx),
+			can_shift_(false),
+			sessions_(static_cast<size_t>(std::max(0, config.session_cache_mb)) << 20),
+			session_hits_(0),
+			session_misses_(0),
+			in_flight_(0),
+			n_active_(0),
+			kv_used_(0),
+			stopping_(false)
+{
+}
+
+BatchScheduler::~BatchScheduler()
+{
+	stop();
+}
+
+bool BatchScheduler::start()
+{
+	int n_parallel = std::max(1, config_.n_parallel);
+
+	// n_ctx is per sequence; the KV cache holds all of them
+	llama_context_params ctx_params = llama_context_default_params();
+	ctx_params.n_ctx = config_.n_ctx * n_parallel;
+	// Room for every slot's drafted tokens; prompt lookup can be turned on
+	// per request, so this is reserved even without a draft model
+	int n_draft = std::max(0, config_.n_draft);
+	ctx_params.n_batch = std::max(config_.n_batch, n_parallel * (1 + n_draft));
+	ctx_params.n_ubatch = config_.n_ubatch;
+	ctx_params.n_seq_max = n_parallel;
+	ctx_params.n_threads = config_.n_threads;
+	ctx_params.n_threads_batch = config_.n_threads_batch;
+	// Names were checked when the engine planned its memory
+	ctx_params.type_k = static_cast<ggml_type>(kv_cache_type(config_.cache_type_k));
+	ctx_params.type_v = static_cast<ggml_type>(kv_cache_type(config_.cache_type_v));
+	ctx_params.flash_attn = config_.flash_attn;
+
+	ctx_ = llama_new_context_with_model(model_, ctx_params);
+	if (!ctx_)
+	{
+		LOG_ERROR("LlamaEngine", "Failed to create context");
+		return false;
+	}
+
+	// Shifting moves positions in the cache, which some models cannot do
+	can_shift_ = config_.context_shift && llama_kv_cache_can_shift(ctx_);
+
+	slots_.resize(n_parallel);
+	for (int i = 0; i < n_parallel; ++i)
+		slots_[i].id = i;
+
+	// Samplers and their buffers live as long as the context
+	int n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(model_));
+	samplers_ = std::make_unique<SamplerPool>(n_vocab);
+	candidates_.resize(n_vocab);
+
+	if (n_draft > 0 && !config_.draft_model_path.empty())
+	{
+		draft_ = std::make_unique<DraftModel>(config_);
+		if (!draft_->load(model_, n_parallel))
+		{
+			LOG_WARN("LlamaEngine", "Continuing without speculative decoding");
+			draft_.reset();
+		}
+	}
+
+	LOG_DEBUG("LlamaEngine", "Context created: " << n_parallel << " x "
+						<< config_.n_ctx << " tokens");
+
+	if (config_.warmup)
+		warmup();
+
+	stopping_ = false;
+	thread_ = std::thread(&BatchScheduler::loop, this);
+	return true;
+}
+
+void BatchScheduler::warmup()
+{
+	// One throwaway decode faults in every weight, lets the backend set up
+	// its buffers and thread pool, and warms the caches, so the first real
+	// request is not slower than the rest
+	auto start = std::chrono::steady_clock::now();
+
+	const llama_vocab *vocab = llama_model_get_vocab(model_);
+	std::vector<llama_token> tokens;
+	if (llama_vocab_bos(vocab) >= 0)
+		tokens.push_back(llama_vocab_bos(vocab));
+	if (llama_vocab_eos(vocab) >= 0)
+		tokens.push_back(llama_vocab_eos(vocab));
+	if (tokens.empty())
+		tokens.push_back(0);
+
+	if (llama_decode(ctx_, llama_batch_get_one(tokens.data(), tokens.size())) != 0)
+		LOG_ERROR("LlamaEngine", "Warmup decode failed");
+	llama_kv_cache_clear(ctx_);
+
+	if (draft_)
+		draft_->warmup();
+
+	LOG_INFO("LlamaEngine", "Warmup: " << static_cast<int>(ms_since(start)) << " ms");
+}
+
+void BatchScheduler::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	cv_.notify_all();
+
+	if (thread_.joinable())
+		thread_.join();
+
+	// Nobody will run these any more
+	for (auto &slot : slots_)
+	{
+		if (slot.task)
+			fail_slot(slot, "engine stopped");
+	}
+
+	std::deque<std::shared_ptr<GenerationTask>> orphans;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		orphans.swap(pending_);
+	}
+	for (auto &task : orphans)
+	{
+		task->result.stop_reason = "error";
+		task->finish();
+		in_flight_--;
+	}
+
+	draft_.reset();
+
+	if (ctx_)
+	{
+		llama_free(ctx_);
+		ctx_ = nullptr;
+	}
+}
+
+void BatchScheduler::submit(std::shared_ptr<GenerationTask> task)
+{
+	in_flight_++;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		pending_.push_back(std::move(task));
+	}
+	cv_.notify_one();
+}
+
+void BatchScheduler::end_session(const std::string &session_id)
+{
+	// Applied by the decode thread before it admits anything else
+	std::lock_guard<std::mutex> lock(mutex_);
+	ended_sessions_.push_back(session_id);
+}
+
+void BatchScheduler::loop()
+{
+	llama_batch batch = llama_batch_init(llama_n_batch(ctx_), 0, 1);
+
+	while (true)
+	{
+		publish_load();
+
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			cv_.wait(lock, [this]()
+							 {
+				if (stopping_)
+					return true;
+				bool any_idle = false;
+				for (const auto &slot : slots_)
+				{
+					if (slot.state != SlotState::IDLE)
+						return true;
+					any_idle = true;
+				}
+				return any_idle && !pending_.empty(); });
+
+			if (stopping_)
+				break;
+		}
+
+		admit_pending();
+
+		batch.n_tokens = 0;
+		for (auto &slot : slots_)
+		{
+			slot.batch_index = -1;
+			slot.n_batched = 0;
+		}
+
+		int n_batch = llama_n_batch(ctx_);
+
+		for (auto &slot : slots_)
+		{
+			if (slot.state != SlotState::GENERATE || (int)slot.cache.size() < n_ctx_slot_)
+				continue;
+
+			// Full: forget the older half of what follows the pinned tokens
+			if (can_shift_ && slot.cache.size() > slot.n_keep + 1)
+			{
+				shift_context(slot, (slot.cache.size() - slot.n_keep) / 2);
+			}
+			else
+			{
+				slot.task->result.stopped_by_limit = true;
+				finish_slot(slot, "length");
+			}
+		}
+
+		draft_tokens();
+
+		// One decode token for every slot that is generating, followed by
+		// whatever was drafted for it
+		for (auto &slot : slots_)
+		{
+			if (slot.state != SlotState::GENERATE)
+				continue;
+
+			slot.batch_index = batch.n_tokens;
+			slot.n_batched = 1 + slot.draft.size();
+			batch_add(batch, slot.pending_token, slot.cache.size(), slot.id, true);
+
+			for (size_t j = 0; j < slot.draft.size(); ++j)
+				batch_add(batch, slot.draft[j], slot.cache.size() + 1 + j, slot.id, true);
+		}
+
+		// Fill the rest of the batch with prompt chunks
+		for (auto &slot : slots_)
+		{
+			if (slot.state != SlotState::PREFILL || batch.n_tokens >= n_batch)
+				continue;
+
+			const auto &tokens = slot.task->tokens;
+			size_t n_eval = std::min(tokens.size() - slot.n_prompt_done, (size_t)(n_batch - batch.n_tokens));
+
+			for (size_t j = 0; j < n_eval; ++j)
+			{
+				size_t pos = slot.n_prompt_done + j;
+				bool is_last = pos == tokens.size() - 1;
+				if (is_last)
+					slot.batch_index = batch.n_tokens;
+				batch_add(batch, tokens[pos], pos, slot.id, is_last);
+			}
+			slot.n_batched = n_eval;
+		}
+
+		if (batch.n_tokens == 0)
+			continue;
+
+		if (llama_decode(ctx_, batch) != 0)
+		{
+			for (auto &slot : slots_)
+			{
+				if (slot.n_batched > 0)
+					fail_slot(slot, "Failed to evaluate batch");
+			}
+			continue;
+		}
+
+		for (auto &slot : slots_)
+		{
+			if (slot.n_batched == 0)
+				continue;
+
+			if (slot.state == SlotState::GENERATE)
+			{
+				slot.cache.push_back(slot.pending_token);
+			}
+			else
+			{
+				const auto &tokens = slot.task->tokens;
+				slot.cache.insert(slot.cache.end(),
+													tokens.begin() + slot.n_prompt_done,
+													tokens.begin() + slot.n_prompt_done + slot.n_batched);
+				slot.n_prompt_done += slot.n_batched;
+			}
+
+			if (slot.batch_index >= 0)
+				sample_slot(slot);
+		}
+	}
+
+	llama_batch_free(batch);
+}
+
+void BatchScheduler::drop_ended_sessions()
+{
+	std::vector<std::string> ended;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		ended.swap(ended_sessions_);
+	}
+
+	for (const auto &session_id : ended)
+	{
+		// The KV stays in the sequence for plain prefix reuse
+		for (auto &slot : slots_)
+		{
+			if (slot.session_id == session_id)
+				slot.session_id.clear();
+		}
+
+		SessionCache::Entry dropped;
+		sessions_.take(session_id, dropped);
+	}
+}
+
+void BatchScheduler::admit_pending()
+{
+	drop_ended_sessions();
+
+	while (true)
+	{
+		bool any_idle = std::any_of(slots_.begin(), slots_.end(), [](const Slot &slot)
+																{ return slot.state == SlotState::IDLE; });
+		if (!any_idle)
+			return;
+
+		std::shared_ptr<GenerationTask> task;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (pending_.empty())
+				return;
+			task = std::move(pending_.front());
+			pending_.pop_front();
+		}
+
+		// Checked before a slot is chosen, so a rejected request cannot
+		// park or replace the KV of a conversation
+		auto &tokens = task->tokens;
+		bool shift = can_shift_ && !task->prefill_only; // warm prompts are cached as given
+		if (tokens.empty() || ((int)tokens.size() >= n_ctx_slot_ && !shift))
+		{
+			reject_task(std::move(task), "Prompt does not fit in the context (" + std::to_string(tokens.size()) +
+																			 " tokens, n_ctx " + std::to_string(n_ctx_slot_) + ")");
+			continue;
+		}
+
+		llama_sampler *grammar = nullptr;
+		if (!task->grammar.empty())
+		{
+			grammar = llama_sampler_init_grammar(llama_model_get_vocab(model_), task->grammar.c_str(), "root");
+			if (!grammar)
+			{
+				reject_task(std::move(task), "Invalid grammar");
+				continue;
+			}
+		}
+
+		Slot *slot = nullptr;
+		const std::string &session_id = task->session_id;
+
+		if (!session_id.empty())
+		{
+			auto own = std::find_if(slots_.begin(), slots_.end(), [&](const Slot &s)
+															{ return s.session_id == session_id; });
+
+			if (own != slots_.end() && own->state == SlotState::IDLE)
+			{
+				// The conversation's KV is still live in its own sequence
+				slot = &*own;
+				session_hits_++;
+			}
+			else
+			{
+				slot = pick_slot(*task);
+				park_session(*slot);
+
+				if (own != slots_.end())
+				{
+					// Another turn of this session is still running; this one
+					// goes without it rather than waiting
+					session_misses_++;
+				}
+				else
+				{
+					if (restore_session(*slot, session_id))
+						session_hits_++;
+					else
+						session_misses_++;
+					slot->session_id = session_id;
+				}
+			}
+		}
+		else
+		{
+			slot = pick_slot(*task);
+			park_session(*slot);
+		}
+
+		start_task(*slot, std::move(task), grammar);
+	}
+}
+
+void BatchScheduler::reject_task(std::shared_ptr<GenerationTask> task, const std::string &message)
+{
+	LOG_ERROR("LlamaEngine", "Generation error: " << message);
+
+	task->result.stop_reason = "error";
+	task->result.prompt_tokens = task->tokens.size();
+	task->result.total_ms = ms_since(task->submitted);
+	task->finish();
+	in_flight_--;
+}
+
+BatchScheduler::Slot *BatchScheduler::pick_slot(const GenerationTask &task)
+{
+	// Prefer idle slots no session is holding, then the one whose cached
+	// tokens share the longest prefix with the new prompt, then the least
+	// recently used one
+	Slot *best = nullptr;
+	size_t best_prefix = 0;
+
+	for (auto &slot : slots_)
+	{
+		if (slot.state != SlotState::IDLE)
+			continue;
+
+		size_t limit = std::min(slot.cache.size(), task.tokens.size());
+		size_t prefix = 0;
+		while (prefix < limit && slot.cache[prefix] == task.tokens[prefix])
+			++prefix;
+
+		bool better = false;
+		if (!best)
+			better = true;
+		else if (slot.session_id.empty() != best->session_id.empty())
+			better = slot.session_id.empty();
+		else if (prefix != best_prefix)
+			better = prefix > best_prefix;
+		else
+			better = slot.last_used < best->last_used;
+
+		if (better)
+		{
+			best = &slot;
+			best_prefix = prefix;
+		}
+	}
+
+	return best;
+}
+
+void BatchScheduler::park_session(Slot &slot)
+{
+	if (slot.session_id.empty())
+		return;
+
+	// The sequence itself is left alone: its prefix may still serve
+	// whatever takes the slot next
+	SessionCache::Entry entry;
+	entry.tokens = slot.cache;
+	entry.n_keep = slot.n_keep;
+	entry.n_discarded = slot.n_discarded;
+	entry.state.resize(llama_state_seq_get_size(ctx_, slot.id));
+	size_t written = llama_state_seq_get_data(ctx_, entry.state.data(), entry.state.size(), slot.id);
+
+	if (written > 0)
+	{
+		entry.state.resize(written);
+		sessions_.put(slot.session_id, std::move(entry));
+
+		LOG_DEBUG("LlamaEngine", "Slot " << slot.id << ": parked session " << slot.session_id
+							<< " (" << written / 1024 << " KiB)");
+	}
+
+	slot.session_id.clear();
+}
+
+bool BatchScheduler::restore_session(Slot &slot, const std::string &session_id)
+{
+	SessionCache::Entry entry;
+	if (!sessions_.take(session_id, entry))
+		return false;
+
+	llama_kv_cache_seq_rm(ctx_, slot.id, -1, -1);
+	slot.cache.clear();
+
+	if (llama_state_seq_set_data(ctx_, entry.state.data(), entry.state.size(), slot.id) == 0)
+	{
+		LOG_WARN("LlamaEngine", "Failed to restore session " << session_id);
+		llama_kv_cache_seq_rm(ctx_, slot.id, -1, -1);
+		return false;
+	}
+
+	slot.cache = std::move(entry.tokens);
+	slot.n_keep = entry.n_keep;
+	slot.n_discarded = entry.n_discarded;
+
+	LOG_DEBUG("LlamaEngine", "Slot " << slot.id << ": restored session " << session_id
+						<< " (" << slot.cache.size() << " tokens)");
+
+	return true;
+}
+
+bool BatchScheduler::load_snapshot(Slot &slot)
+{
+	const auto &task = *slot.task;
+	std::vector<int> tokens(n_ctx_slot_);
+	size_t n_tokens = 0;
+
+	llama_kv_cache_seq_rm(ctx_, slot.id, -1, -1);
+	slot.cache.clear();
+
+	size_t n_read = llama_state_seq_load_file(ctx_, task.snapshot_path.c_str(), slot.id,
+																						 tokens.data(), tokens.size(), &n_tokens);
+	tokens.resize(n_tokens);
+
+	// A missing or stale file, or one written for other tokens
+	if (n_read == 0 || tokens != task.tokens)
+	{
+		llama_kv_cache_seq_rm(ctx_, slot.id, -1, -1);
+		return false;
+	}
+
+	slot.cache = std::move(tokens);
+
+	LOG_INFO("LlamaEngine", "Loaded prompt snapshot: " << slot.cache.size() << " tokens from "
+						<< task.snapshot_path);
+	return true;
+}
+
+void BatchScheduler::save_snapshot(const Slot &slot)
+{
+	const std::string &path = slot.task->snapshot_path;
+
+	// Write beside the target and rename, so a concurrent start never
+	// reads half a file
+	std::string tmp = path + ".tmp";
+	size_t n_written = llama_state_seq_save_file(ctx_, tmp.c_str(), slot.id,
+																							 slot.cache.data(), slot.cache.size());
+
+	if (n_written == 0 || std::rename(tmp.c_str(), path.c_str()) != 0)
+	{
+		LOG_WARN("LlamaEngine", "Failed to save prompt snapshot: " << path);
+		std::remove(tmp.c_str());
+		return;
+	}
+
+	LOG_INFO("LlamaEngine", "Saved prompt snapshot: " << slot.cache.size() << " tokens to "
+						<< path);
+}
+
+void BatchScheduler::share_prefix(const Slot &slot)
+{
+	// Copied sequences share KV cells, so this costs no extra cache memory
+	for (auto &other : slots_)
+	{
+		if (other.id == slot.id || other.state != SlotState::IDLE || !other.session_id.empty())
+			continue;
+
+		llama_kv_cache_seq_rm(ctx_, other.id, -1, -1);
+		llama_kv_cache_seq_cp(ctx_, slot.id, other.id, -1, -1);
+		other.cache = slot.cache;
+		other.n_discarded = 0;
+	}
+}
+
+SessionStats BatchScheduler::session_stats() const
+{
+	SessionStats stats;
+	stats.hits = session_hits_;
+	stats.misses = session_misses_;
+	stats.evictions = sessions_.evictions();
+	stats.parked = sessions_.size();
+	stats.parked_bytes = sessions_.bytes();
+	return stats;
+}
+
+GenerationStats BatchScheduler::generation_stats() const
+{
+	std::lock_guard<std::mutex> lock(stats_mutex_);
+	return stats_;
+}
+
+void BatchScheduler::publish_load()
+{
+	int active = 0;
+	uint64_t kv_used = 0;
+	for (const auto &slot : slots_)
+	{
+		if (slot.state != SlotState::IDLE)
+			active++;
+		kv_used += slot.cache.size();
+	}
+
+	n_active_.store(active, std::memory_order_relaxed);
+	kv_used_.store(kv_used, std::memory_order_relaxed);
+}
+
+SchedulerLoad BatchScheduler::current_load() const
+{
+	SchedulerLoad load;
+	load.active = n_active_.load(std::memory_order_relaxed);
+	load.queued = std::max(0, in_flight_.load(std::memory_order_relaxed) - load.active);
+	load.kv_used = kv_used_.load(std::memory_order_relaxed);
+	load.kv_size = static_cast<uint64_t>(n_ctx_slot_) * slots_.size();
+	return load;
+}
+
+void BatchScheduler::start_task(Slot &slot, std::shared_ptr<GenerationTask> task, llama_sampler *grammar)
+{
+	slot.task = std::move(task);
+	slot.grammar = grammar;
+	slot.text.clear();
+	slot.streamed = 0;
+	slot.started = std::chrono::steady_clock::now();
+
+	auto &result = slot.task->result;
+	auto &tokens = slot.task->tokens;
+	size_t n_prompt = tokens.size();
+
+	// admit_pending() rejected prompts that would need a shift without one
+	if (can_shift_ && !slot.task->prefill_only)
+	{
+		drop_discarded(slot);
+	}
+	else
+	{
+		slot.n_keep = 0;
+		slot.n_discarded = 0;
+	}
+
+	// Skip the part of the prompt whose KV is still cached for this
+	// sequence (system prompt, tool list, earlier turns)
+	size_t n_keep = 0;
+	size_t limit = std::min(slot.cache.size(), tokens.size());
+	while (n_keep < limit && slot.cache[n_keep] == tokens[n_keep])
+		++n_keep;
+
+	if ((int)tokens.size() >= n_ctx_slot_)
+		n_keep = shorten_prompt(slot, n_keep);
+
+	// The last prompt token is always decoded again so there are fresh
+	// logits to sample the first new token from
+	if (n_keep == tokens.size())
+		--n_keep;
+
+	if (!llama_kv_cache_seq_rm(ctx_, slot.id, n_keep, -1))
+	{
+		// Partial removal unsupported (e.g. recurrent models): start over
+		llama_kv_cache_seq_rm(ctx_, slot.id, -1, -1);
+		n_keep = 0;
+	}
+
+	slot.cache.resize(n_keep);
+
+	if (slot.task->prefill_only && !slot.task->snapshot_path.empty() && n_keep + 1 < tokens.size())
+	{
+		if (load_snapshot(slot))
+		{
+			result.prompt_tokens = tokens.size();
+			result.cached_tokens = tokens.size();
+			share_prefix(slot);
+			finish_slot(slot, "restored");
+			return;
+		}
+
+		// The failed load left the sequence empty
+		n_keep = 0;
+	}
+
+	slot.n_prompt_done = n_keep;
+	slot.max_gen = slot.task->max_tokens > 0 ? slot.task->max_tokens : config_.max_tokens;
+	slot.sampler = samplers_->acquire(slot.task->sampling);
+	slot.json_end = {};
+	slot.stop = StopMatcher(slot.task->stop);
+	slot.state = SlotState::PREFILL;
+
+	result.prompt_tokens = n_prompt;
+	result.cached_tokens = n_keep;
+	result.prefill_tokens = tokens.size() - n_keep;
+	result.queue_ms = std::chrono::duration<float, std::milli>(slot.started - slot.task->submitted).count();
+
+	LOG_DEBUG("LlamaEngine", "Slot " << slot.id << ": " << n_keep << "/" << tokens.size()
+						<< " prompt tokens cached");
+}
+
+void BatchScheduler::drop_discarded(Slot &slot)
+{
+	auto &tokens = slot.task->tokens;
+	size_t n_keep = std::min<size_t>(std::max(slot.task->n_keep, 0), n_ctx_slot_ / 2);
+
+	// A shifted sequence caches its conversation with a middle part left
+	// out. A prompt continuing that conversation loses the same part, so
+	// its cached prefix lines up again.
+	size_t n_discarded = slot.n_discarded;
+	bool continues = n_discarded > 0 && slot.n_keep == n_keep &&
+									 slot.cache.size() > n_keep &&
+									 tokens.size() >= slot.cache.size() + n_discarded &&
+									 std::equal(slot.cache.begin(), slot.cache.begin() + n_keep, tokens.begin()) &&
+									 std::equal(slot.cache.begin() + n_keep, slot.cache.end(), tokens.begin() + n_keep + n_discarded);
+
+	if (continues)
+		tokens.erase(tokens.begin() + n_keep, tokens.begin() + n_keep + n_discarded);
+	else
+		slot.n_discarded = 0;
+
+	slot.n_keep = n_keep;
+}
+
+size_t BatchScheduler::shorten_prompt(Slot &slot, size_t n_cached)
+{
+	// Drop the oldest tokens after the pinned ones, so that half of the
+	// rest of the context is left for generation
+	auto &tokens = slot.task->tokens;
+	size_t n_keep = slot.n_keep;
+	size_t n_drop = tokens.size() - (n_keep + (n_ctx_slot_ - n_keep) / 2);
+
+	if (n_cached >= n_keep + n_drop)
+	{
+		// They are cached: move the KV behind them down instead of
+		// prefilling it again
+		llama_kv_cache_seq_rm(ctx_, slot.id, n_cached, -1);
+		slot.cache.resize(n_cached);
+		shift_context(slot, n_drop);
+		n_cached -= n_drop;
+	}
+	else
+	{
+		n_cached = std::min(n_cached, n_keep);
+		slot.n_discarded += n_drop;
+	}
+
+	tokens.erase(tokens.begin() + n_keep, tokens.begin() + n_keep + n_drop);
+	return n_cached;
+}
+
+void BatchScheduler::shift_context(Slot &slot, size_t n_discard)
+{
+	size_t n_keep = slot.n_keep;
+	size_t n_past = slot.cache.size();
+
+	llama_kv_cache_seq_rm(ctx_, slot.id, n_keep, n_keep + n_discard);
+	llama_kv_cache_seq_add(ctx_, slot.id, n_keep + n_discard, n_past, -(int)n_discard);
+
+	slot.cache.erase(slot.cache.begin() + n_keep, slot.cache.begin() + n_keep + n_discard);
+	slot.n_discarded += n_discard;
+
+	LOG_DEBUG("LlamaEngine", "Slot " << slot.id << ": context shifted by " << n_discard
+						<< " tokens (" << n_keep << " kept, " << slot.cache.size() << " left)");
+}
+
+void BatchScheduler::draft_tokens()
+{
+	std::vector<DraftRequest> requests;
+
+	for (auto &slot : slots_)
+	{
+		slot.draft.clear();
+		slot.draft_from_lookup = false;
+		if (slot.state != SlotState::GENERATE)
+			continue;
+
+		// Every drafted token needs a KV position, and the step may emit
+		// all of them plus one
+		const auto &result = slot.task->result;
+		int n_draft = std::min({config_.n_draft,
+														n_ctx_slot_ - (int)slot.cache.size() - 1,
+														slot.max_gen - result.tokens_generated - 1});
+		if (n_draft <= 0)
+			continue;
+
+		if (slot.task->prompt_lookup)
+		{
+			prompt_lookup_draft(slot.cache, slot.pending_token, config_.lookup_ngram, n_draft, slot.draft);
+			if (!slot.draft.empty())
+			{
+				slot.draft_from_lookup = true;
+				continue;
+			}
+		}
+
+		if (!draft_)
+			continue;
+
+		DraftRequest request;
+		request.seq_id = slot.id;
+		request.tokens = &slot.cache;
+		request.pending_token = slot.pending_token;
+		request.n_draft = n_draft;
+		requests.push_back(std::move(request));
+	}
+
+	if (requests.empty())
+		return;
+
+	draft_->draft(requests);
+
+	for (auto &request : requests)
+		slots_[request.seq_id].draft = std::move(request.draft);
+}
+
+void BatchScheduler::sample_slot(Slot &slot)
+{
+	auto &task = *slot.task;
+	auto &result = task.result;
+
+	if (task.prefill_only)
+	{
+		if (!task.snapshot_path.empty())
+			save_snapshot(slot);
+		share_prefix(slot);
+		finish_slot(slot, "prefilled");
+		return;
+	}
+
+	bool first = slot.state == SlotState::PREFILL;
+	if (first)
+	{
+		slot.state = SlotState::GENERATE;
+		result.first_token_ms = ms_since(task.submitted);
+		result.prefill_ms = ms_since(slot.started);
+	}
+
+	// The first token's latency is the prefill; after that each step's
+	// time is split over the tokens it produces. Taken before sampling,
+	// since any token may end the task.
+	auto now = std::chrono::steady_clock::now();
+	slot.step_ms = first ? 0.0f : std::chrono::duration<float, std::milli>(now - slot.last_token).count();
+	slot.step_first = result.tokens_generated;
+	slot.last_token = now;
+
+	// Row i has the logits that follow the pending token and the first i
+	// drafted ones. Every token is sampled exactly as without a draft; a
+	// drafted token is only kept when the sample agrees with it, so the
+	// output distribution does not change.
+	size_t n_draft = slot.draft.size();
+	result.draft_tokens += n_draft;
+	if (slot.draft_from_lookup)
+		result.lookup_tokens += n_draft;
+
+	for (size_t i = 0; i <= n_draft; ++i)
+	{
+		int token = sample_token(slot, slot.batch_index + i);
+		bool accepted = i < n_draft && token == slot.draft[i];
+		if (accepted)
+		{
+			result.draft_accepted++;
+			if (slot.draft_from_lookup)
+				result.lookup_accepted++;
+		}
+
+		if (!accept_token(slot, token) || !accepted)
+			break;
+
+		// Its KV entry was written by this batch
+		slot.cache.push_back(token);
+	}
+
+	if (n_draft > 0)
+	{
+		// Forget the KV of the rejected part of the draft
+		llama_kv_cache_seq_rm(ctx_, slot.id, slot.cache.size(), -1);
+		slot.draft.clear();
+	}
+
+	// A finished slot already recorded the step, and has no task now
+	if (slot.task)
+		record_step(slot);
+}
+
+void BatchScheduler::record_step(Slot &slot)
+{
+	auto &result = slot.task->result;
+	int n_new = result.tokens_generated - slot.step_first;
+	if (slot.step_ms > 0 && n_new > 0)
+		result.token_ms.insert(result.token_ms.end(), n_new, slot.step_ms / n_new);
+
+	slot.step_ms = 0.0f;
+	slot.step_first = result.tokens_generated;
+}
+
+int BatchScheduler::sample_token(Slot &slot, int batch_index)
+{
+	// The row is only read once, so the penalty can go straight into it
+	float *logits = llama_get_logits_ith(ctx_, batch_index);
+	slot.sampler->penalize(logits);
+	int token = slot.sampler->sample(logits);
+
+	if (!slot.grammar)
+	{
+		slot.sampler->accept(token);
+		return token;
+	}
+
+	// Constraining the whole vocabulary is expensive, so sample freely
+	// first and only fall back to it when the grammar rejects the result
+	llama_token_data single = {token, 1.0f, 0.0f};
+	llama_token_data_array check = {&single, 1, -1, false};
+	llama_sampler_apply(slot.grammar, &check);
+
+	if (single.logit == -INFINITY)
+	{
+		for (size_t i = 0; i < candidates_.size(); ++i)
+			candidates_[i] = llama_token_data{(int)i, logits[i], 0.0f};
+		llama_token_data_array cur = {candidates_.data(), candidates_.size(), -1, false};
+
+		llama_sampler_apply(slot.grammar, &cur);
+		slot.sampler->retry(&cur);
+		token = cur.data[cur.selected].id;
+	}
+
+	llama_sampler_accept(slot.grammar, token);
+	slot.sampler->accept(token);
+	return token;
+}
+
+// Emits one sampled token. Returns false once the slot has finished.
+bool BatchScheduler::accept_token(Slot &slot, int token)
+{
+	auto &task = *slot.task;
+	auto &result = task.result;
+	const llama_vocab *vocab = llama_model_get_vocab(model_);
+
+	// Check for EOS
+	if (llama_vocab_is_eog(vocab, token))
+	{
+		finish_slot(slot, "eos");
+		return false;
+	}
+
+	result.output_tokens.push_back(token);
+
+	char buf[128];
+	int n = llama_token_to_piece(vocab, token, buf, sizeof(buf), 0, false);
+	if (n > 0)
+		slot.text.append(buf, n);
+
+	// The stop and anything after it are cut; finish_slot() streams what
+	// comes before
+	size_t cut = slot.stop.feed(buf, std::max(n, 0));
+	if (cut != std::string::npos)
+	{
+		slot.text.resize(cut);
+		finish_slot(slot, "stop_sequence");
+		return false;
+	}
+
+	bool json_closed = task.stop_at_json_end && reached_json_end(slot);
+
+	// Hold back a tail that may still turn out to be the start of a stop
+	if (!stream_text(slot, slot.text.size() - std::min(slot.stop.pending(), slot.text.size())))
+	{
+		finish_slot(slot, "cancelled");
+		return false;
+	}
+
+	result.tokens_generated++;
+
+	if (json_closed)
+	{
+		// Nothing after the closing brace can matter to the caller
+		finish_slot(slot, "json_end");
+		return false;
+	}
+
+	if (result.tokens_generated >= slot.max_gen)
+	{
+		result.stopped_by_limit = true;
+		finish_slot(slot, "length");
+		return false;
+	}
+
+	slot.pending_token = token;
+	return true;
+}
+
+// Sends text[streamed, end) to a streaming caller, minus any trailing
+// partial UTF-8 character. Returns false if the caller cancelled.
+bool BatchScheduler::stream_text(Slot &slot, size_t end)
+{
+	const auto &on_token = slot.task->on_token;
+	if (!on_token)
+		return true;
+
+	size_t ready = utf8_complete_length(slot.text, end);
+	if (ready <= slot.streamed)
+		return true;
+
+	bool keep_going = on_token(slot.text.substr(slot.streamed, ready - slot.streamed));
+	slot.streamed = ready;
+	return keep_going;
+}
+
+// Scans the new part of the output. True once the top-level JSON object
+// or array it opens with has closed; the text is cut right after it.
+bool BatchScheduler::reached_json_end(Slot &slot)
+{
+	auto &scan = slot.json_end;
+	const std::string &text = slot.text;
+
+	if (scan.not_json)
+		return false;
+
+	for (; scan.scanned < text.size(); ++scan.scanned)
+	{
+		char c = text[scan.scanned];
+
+		if (scan.in_string)
+		{
+			if (scan.escape)
+				scan.escape = false;
+			else if (c == '\\')
+				scan.escape = true;
+			else if (c == '"')
+				scan.in_string = false;
+			continue;
+		}
+
+		if (scan.depth == 0)
+		{
+			if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+				continue;
+			if (c != '{' && c != '[')
+			{
+				// Not a JSON object or array; never look again
+				scan.not_json = true;
+				return false;
+			}
+		}
+
+		if (c == '"')
+			scan.in_string = true;
+		else if (c == '{' || c == '[')
+			scan.depth++;
+		else if ((c == '}' || c == ']') && --scan.depth == 0)
+		{
+			slot.text.resize(scan.scanned + 1);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void BatchScheduler::finish_slot(Slot &slot, const std::string &reason)
+{
+	auto &result = slot.task->result;
+
+	// The step that ended the task still counts towards its latency
+	record_step(slot);
+
+	// Whatever was held back for a possible stop is final now
+	if (reason != "cancelled")
+		stream_text(slot, slot.text.size());
+
+	result.stop_reason = reason;
+	result.text = std::move(slot.text);
+	result.total_ms = ms_since(slot.task->submitted);
+
+	// Prefill and decode are timed apart, so a long prompt does not look
+	// like slow decoding
+	if (result.tokens_generated == 0)
+		result.prefill_ms = ms_since(slot.started);
+	for (float ms : result.token_ms)
+		result.decode_ms += ms;
+	if (result.decode_ms > 0)
+		result.tokens_per_second = result.token_ms.size() / (result.decode_ms / 1000.0f);
+	if (result.prefill_ms > 0)
+		result.prefill_tokens_per_second = result.prefill_tokens / (result.prefill_ms / 1000.0f);
+	result.token_ms_p50 = percentile(result.token_ms, 50);
+	result.token_ms_p90 = percentile(result.token_ms, 90);
+	result.token_ms_p99 = percentile(result.token_ms, 99);
+	if (result.draft_tokens > 0)
+		result.draft_accept_rate = (float)result.draft_accepted / result.draft_tokens;
+
+	// Warm-up prefills are not generations; keep them out of the log and
+	// the server-wide stats
+	if (!slot.task->prefill_only)
+		LOG_INFO("LlamaEngine", "Generation complete: " << result.tokens_generated
+							<< " tokens, " << result.tokens_per_second << " t/s");
+
+	if (slot.task->trace)
+	{
+		// On this, the decode thread, rebuilt from the timings above
+		auto now = std::chrono::steady_clock::now();
+		auto prefilled = std::min(now, slot.started + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+																											std::chrono::duration<float, std::milli>(result.prefill_ms)));
+		Trace &trace = *slot.task->trace;
+		trace.add("slot queue", "llm", slot.task->submitted, slot.started, {{"slot", slot.id}});
+		trace.add("prefill", "llm", slot.started, prefilled,
+							{{"slot", slot.id}, {"prompt_tokens", result.prompt_tokens}, {"cached_tokens", result.cached_tokens}, {"prefill_tokens", result.prefill_tokens}});
+		if (result.tokens_generated > 0)
+			trace.add("decode", "llm", prefilled, now,
+								{{"slot", slot.id}, {"tokens", result.tokens_generated}, {"tokens_per_second", result.tokens_per_second}, {"stop_reason", reason}});
+	}
+
+	if (!slot.task->prefill_only)
+	{
+		std::lock_guard<std::mutex> lock(stats_mutex_);
+		stats_.requests++;
+		stats_.prompt_tokens += result.prompt_tokens;
+		stats_.prefill_tokens += result.prefill_tokens;
+		stats_.generated_tokens += result.tokens_generated;
+		stats_.queue_ms += result.queue_ms;
+		stats_.prefill_ms += result.prefill_ms;
+		stats_.decode_ms += result.decode_ms;
+		if (result.tokens_generated > 0)
+			stats_.first_token_ms.add(result.first_token_ms);
+		for (float ms : result.token_ms)
+			stats_.token_ms.add(ms);
+	}
+
+	if (slot.grammar)
+	{
+		llama_sampler_free(slot.grammar);
+		slot.grammar = nullptr;
+	}
+	samplers_->release(std::move(slot.sampler));
+
+	slot.text.clear();
+	slot.draft.clear();
+	slot.task->finish();
+	slot.task.reset();
+	in_flight_--;
+	slot.state = SlotState::IDLE;
+	slot.last_used = std::chrono::steady_clock::now();
+}
+
+void BatchScheduler::fail_slot(Slot &slot, const std::string &message)
+{
+	LOG_ERROR("LlamaEngine", "Generation error: " << message);
+
+	// The sequence's KV may be half-written; forget it entirely, along
+	// with the session it belonged to
+	llama_kv_cache_seq_rm(ctx_, slot.id, -1, -1);
+	slot.cache.clear();
+	slot.n_discarded = 0;
+	slot.session_id.clear();
+	slot.text.clear();
+
+	finish_slot(slot, "error");
+}
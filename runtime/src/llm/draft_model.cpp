@@ -0,0 +1,209 @@
+#include "llm/draft_model.h"
+#include "core/logger.h"
+#include "llm/batch_util.h"
+#include "llama.h"
+#include <algorithm>
+
+DraftModel::DraftModel(const LlamaConfig &config)
+		: config_(config), model_(nullptr), ctx_(nullptr), n_vocab_(0)
+{
+}
+
+DraftModel::~DraftModel()
+{
+	if (ctx_)
+		llama_free(ctx_);
+	if (model_)
+		llama_free_model(model_);
+}
+
+bool DraftModel::load(const llama_model *target, int n_seq)
+{
+	LOG_INFO("LlamaEngine", "Loading draft model: " << config_.draft_model_path);
+
+	llama_model_params model_params = llama_model_default_params();
+	model_params.use_mmap = config_.use_mmap;
+	model_params.use_mlock = config_.use_mlock;
+
+	model_ = llama_load_model_from_file(config_.draft_model_path.c_str(), model_params);
+	if (!model_)
+	{
+		LOG_ERROR("LlamaEngine", "Failed to load draft model");
+		return false;
+	}
+
+	// Drafted token ids are fed to the target as-is
+	const llama_vocab *vocab = llama_model_get_vocab(model_);
+	const llama_vocab *target_vocab = llama_model_get_vocab(target);
+	if (llama_vocab_n_tokens(vocab) != llama_vocab_n_tokens(target_vocab) ||
+			llama_vocab_bos(vocab) != llama_vocab_bos(target_vocab) ||
+			llama_vocab_eos(vocab) != llama_vocab_eos(target_vocab))
+	{
+		LOG_ERROR("LlamaEngine", "Draft model vocabulary does not match the main model");
+		return false;
+	}
+	n_vocab_ = llama_vocab_n_tokens(vocab);
+
+	llama_context_params ctx_params = llama_context_default_params();
+	ctx_params.n_ctx = config_.n_ctx * n_seq;
+	ctx_params.n_batch = std::max(config_.n_batch, n_seq);
+	ctx_params.n_ubatch = config_.n_ubatch;
+	ctx_params.n_seq_max = n_seq;
+	ctx_params.n_threads = config_.n_threads;
+	ctx_params.n_threads_batch = config_.n_threads_batch;
+
+	ctx_ = llama_new_context_with_model(model_, ctx_params);
+	if (!ctx_)
+	{
+		LOG_ERROR("LlamaEngine", "Failed to create draft context");
+		return false;
+	}
+
+	cache_.assign(n_seq, {});
+	return true;
+}
+
+void DraftModel::warmup()
+{
+	llama_token bos = llama_vocab_bos(llama_model_get_vocab(model_));
+	if (bos < 0)
+		bos = 0;
+
+	if (llama_decode(ctx_, llama_batch_get_one(&bos, 1)) != 0)
+		LOG_ERROR("LlamaEngine", "Draft warmup decode failed");
+	llama_kv_cache_clear(ctx_);
+}
+
+int DraftModel::argmax(int batch_index) const
+{
+	const float *logits = llama_get_logits_ith(ctx_, batch_index);
+
+	int best = 0;
+	for (int i = 1; i < n_vocab_; ++i)
+	{
+		if (logits[i] > logits[best])
+			best = i;
+	}
+	return best;
+}
+
+void DraftModel::draft(std::vector<DraftRequest> &requests)
+{
+	int n_batch = llama_n_batch(ctx_);
+	llama_batch batch = llama_batch_init(n_batch, 0, 1);
+
+	std::vector<int> rows(requests.size(), -1);
+	std::vector<size_t> in_batch;
+	bool failed = false;
+
+	// Decodes the current batch and takes the first draft token of every
+	// request whose last catch-up token was in it
+	auto flush = [&]()
+	{
+		if (batch.n_tokens > 0 && !failed)
+		{
+			failed = llama_decode(ctx_, batch) != 0;
+			for (size_t i : in_batch)
+			{
+				if (!failed)
+					requests[i].draft.push_back(argmax(rows[i]));
+			}
+		}
+		in_batch.clear();
+		batch.n_tokens = 0;
+	};
+
+	// Catch up with the target: its cached tokens plus the pending one
+	for (size_t i = 0; i < requests.size(); ++i)
+	{
+		auto &request = requests[i];
+		auto &cache = cache_[request.seq_id];
+		const auto &tokens = *request.tokens;
+
+		request.draft.clear();
+		if (request.n_draft <= 0)
+			continue;
+
+		size_t n_history = tokens.size() + 1;
+		auto history = [&](size_t k)
+		{
+			return k < tokens.size() ? tokens[k] : request.pending_token;
+		};
+
+		size_t n_keep = 0;
+		size_t limit = std::min(cache.size(), n_history);
+		while (n_keep < limit && cache[n_keep] == history(n_keep))
+			++n_keep;
+
+		// Fresh logits are needed for the last one
+		if (n_keep == n_history)
+			--n_keep;
+
+		llama_kv_cache_seq_rm(ctx_, request.seq_id, n_keep, -1);
+		cache.resize(n_keep);
+
+		for (size_t k = n_keep; k < n_history; ++k)
+		{
+			if (batch.n_tokens >= n_batch)
+				flush();
+
+			bool is_last = k == n_history - 1;
+			if (is_last)
+			{
+				rows[i] = batch.n_tokens;
+				in_batch.push_back(i);
+			}
+			batch_add(batch, history(k), k, request.seq_id, is_last);
+			cache.push_back(history(k));
+		}
+	}
+	flush();
+
+	// Extend every draft by one token per step until each is long enough
+	// or has hit the end of generation
+	const llama_vocab *vocab = llama_model_get_vocab(model_);
+
+	while (!failed)
+	{
+		for (size_t i = 0; i < requests.size(); ++i)
+		{
+			auto &request = requests[i];
+			rows[i] = -1;
+
+			if (request.draft.empty() || (int)request.draft.size() >= request.n_draft ||
+					llama_vocab_is_eog(vocab, request.draft.back()))
+				continue;
+
+			auto &cache = cache_[request.seq_id];
+			rows[i] = batch.n_tokens;
+			batch_add(batch, request.draft.back(), cache.size(), request.seq_id, true);
+			cache.push_back(request.draft.back());
+		}
+
+		if (batch.n_tokens == 0)
+			break;
+
+		failed = llama_decode(ctx_, batch) != 0;
+		batch.n_tokens = 0;
+
+		for (size_t i = 0; i < requests.size() && !failed; ++i)
+		{
+			if (rows[i] >= 0)
+				requests[i].draft.push_back(argmax(rows[i]));
+		}
+	}
+
+	llama_batch_free(batch);
+
+	if (failed)
+	{
+		// Nothing in the draft cache can be trusted any more
+		LOG_ERROR("LlamaEngine", "Draft decode failed");
+		for (auto &request : requests)
+		{
+			llama_kv_cache_seq_rm(ctx_, request.seq_id, -1, -1);
+			cache_[request.seq_id].clear();
+			request.draft.clear();
+		}
+	}
+}
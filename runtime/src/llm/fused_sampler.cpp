@@ -0,0 +1,229 @@
+#include "llm/fused_sampler.h"
+#include "llama.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <functional>
+
+// Logits sampled to estimate where the k-th best lies
+static constexpr int SAMPLE_SIZE = 1024;
+
+// How many times k the estimated threshold aims to let through. Above 1
+// so one scan is almost always enough; small so sorting them stays cheap.
+static constexpr long long SURVIVOR_FACTOR = 4;
+
+FusedSampler::FusedSampler(int n_vocab, const SamplingParams &params)
+		: n_vocab_(n_vocab),
+			rng_(std::random_device{}()),
+			n_recent_(0),
+			logits_(n_vocab),
+			kept_(n_vocab),
+			probs_(n_vocab),
+			sample_(SAMPLE_SIZE),
+			n_kept_(0),
+			draw_(0.0f)
+{
+	configure(params);
+}
+
+FusedSampler::~FusedSampler() = default;
+
+void FusedSampler::configure(const SamplingParams &params)
+{
+	params_ = params;
+
+	if (params.seed != LLAMA_DEFAULT_SEED)
+		rng_.seed(params.seed);
+
+	recent_.resize(std::max(params.repeat_last_n, 0));
+	n_recent_ = 0;
+}
+
+void FusedSampler::accept(int token)
+{
+	if (recent_.empty())
+		return;
+
+	recent_[n_recent_ % recent_.size()] = token;
+	n_recent_++;
+}
+
+void FusedSampler::penalize(float *logits) const
+{
+	if (params_.repeat_penalty == 1.0f || params_.repeat_penalty <= 0.0f)
+		return;
+
+	// Once per distinct token, as llama.cpp's penalties sampler does
+	size_t n = std::min(n_recent_, recent_.size());
+	for (size_t i = 0; i < n; ++i)
+	{
+		int token = recent_[i];
+		if (token < 0 || token >= n_vocab_ || std::find(recent_.begin(), recent_.begin() + i, token) != recent_.begin() + i)
+			continue;
+
+		float &logit = logits[token];
+		logit = logit > 0 ? logit / params_.repeat_penalty : logit * params_.repeat_penalty;
+	}
+}
+
+int FusedSampler::sample(const float *logits)
+{
+	return kept_[select(logits, n_vocab_, true)];
+}
+
+void FusedSampler::apply(llama_token_data_array *cur)
+{
+	filter(cur, true);
+}
+
+void FusedSampler::retry(llama_token_data_array *cur)
+{
+	filter(cur, false);
+}
+
+void FusedSampler::filter(llama_token_data_array *cur, bool redraw)
+{
+	int n = static_cast<int>(cur->size);
+	if (n > (int)logits_.size())
+	{
+		logits_.resize(n);
+		kept_.resize(n);
+		probs_.resize(n);
+	}
+
+	for (int i = 0; i < n; ++i)
+		logits_[i] = cur->data[i].logit;
+
+	int chosen = select(logits_.data(), n, redraw);
+
+	// Survivors are in probability order, not array order, so moving them
+	// to the front in place could overwrite one before it is read
+	out_.resize(n_kept_);
+	for (int i = 0; i < n_kept_; ++i)
+		out_[i] = llama_token_data{cur->data[kept_[i]].id, logits_[kept_[i]], probs_[i]};
+
+	std::copy(out_.begin(), out_.end(), cur->data);
+	cur->size = n_kept_;
+	cur->selected = chosen;
+	cur->sorted = true;
+}
+
+int FusedSampler::select(const float *logits, int n, bool redraw)
+{
+	if (params_.temperature <= 0.0f)
+	{
+		int best = 0;
+		for (int i = 1; i < n; ++i)
+		{
+			if (logits[i] > logits[best])
+				best = i;
+		}
+		kept_[0] = best;
+		probs_[0] = 1.0f;
+		n_kept_ = 1;
+		return 0;
+	}
+
+	int k = params_.top_k > 0 ? std::min(params_.top_k, n) : n;
+
+	// Guess, from an evenly spaced sample of the row, a threshold that lets
+	// about SURVIVOR_FACTOR * k logits through, then keep everything at or
+	// above it. If fewer than k made it, the guess was too high; lower it.
+	// Masked (-inf) logits never survive.
+	int n_sample = std::min(n, SAMPLE_SIZE);
+	int stride = n / n_sample;
+	int count = 0;
+
+	for (long long want = (long long)k * SURVIVOR_FACTOR;; want *= SURVIVOR_FACTOR)
+	{
+		long long rank = want * n_sample / n;
+		float threshold = -FLT_MAX;
+		if (rank < n_sample)
+		{
+			for (int i = 0; i < n_sample; ++i)
+				sample_[i] = logits[i * stride];
+			std::nth_element(sample_.begin(), sample_.begin() + rank, sample_.begin() + n_sample, std::greater<float>());
+			threshold = std::max(sample_[rank], -FLT_MAX);
+		}
+
+		// Branch-free compaction: always store, only advance on a survivor
+		count = 0;
+		for (int i = 0; i < n; ++i)
+		{
+			kept_[count] = i;
+			count += logits[i] >= threshold;
+		}
+
+		if (count >= k || threshold == -FLT_MAX)
+			break;
+	}
+
+	if (count == 0)
+	{
+		// Everything masked; nothing sensible to pick
+		kept_[0] = 0;
+		probs_[0] = 1.0f;
+		n_kept_ = 1;
+		return 0;
+	}
+
+	k = std::min(k, count);
+
+	auto by_logit = [logits](int a, int b)
+	{
+		return logits[a] > logits[b];
+	};
+	std::partial_sort(kept_.begin(), kept_.begin() + k, kept_.begin() + count, by_logit);
+	n_kept_ = k;
+
+	float max = logits[kept_[0]];
+
+	// top_p comes before temperature in the chain, so its cut is made on
+	// the unscaled distribution
+	if (params_.top_p < 1.0f)
+	{
+		float sum = 0.0f;
+		for (int i = 0; i < n_kept_; ++i)
+		{
+			probs_[i] = std::exp(logits[kept_[i]] - max);
+			sum += probs_[i];
+		}
+
+		float cum = 0.0f;
+		for (int i = 0; i < n_kept_; ++i)
+		{
+			cum += probs_[i];
+			if (cum >= params_.top_p * sum)
+			{
+				n_kept_ = i + 1;
+				break;
+			}
+		}
+	}
+
+	float sum = 0.0f;
+	for (int i = 0; i < n_kept_; ++i)
+	{
+		probs_[i] = std::exp((logits[kept_[i]] - max) / params_.temperature);
+		sum += probs_[i];
+	}
+
+	if (redraw)
+		draw_ = std::uniform_real_distribution<float>(0.0f, 1.0f)(rng_);
+	float r = draw_ * sum;
+	int chosen = n_kept_ - 1;
+	for (int i = 0; i < n_kept_; ++i)
+	{
+		r -= probs_[i];
+		if (r < 0.0f)
+		{
+			chosen = i;
+			break;
+		}
+	}
+
+	for (int i = 0; i < n_kept_; ++i)
+		probs_[i] /= sum;
+
+	return chosen;
+}
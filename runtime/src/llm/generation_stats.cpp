@@ -0,0 +1,101 @@
+#include "llm/generation_stats.h"
+#include <algorithm>
+#include <cmath>
+
+static constexpr float FIRST_BOUND_MS = 0.1f;
+static constexpr int BUCKETS_PER_DOUBLING = 4;
+
+float LatencyHistogram::bound(int bucket)
+{
+	if (bucket >= N_BUCKETS - 1)
+		return INFINITY;
+	return FIRST_BOUND_MS * std::exp2(static_cast<float>(bucket) / BUCKETS_PER_DOUBLING);
+}
+
+int LatencyHistogram::bucket_of(float ms)
+{
+	if (!(ms > FIRST_BOUND_MS))
+		return 0;
+
+	int bucket = static_cast<int>(std::ceil(std::log2(ms / FIRST_BOUND_MS) * BUCKETS_PER_DOUBLING));
+	return std::min(bucket, N_BUCKETS - 1);
+}
+
+LatencyHistogram LatencyHistogram::from_buckets(const uint64_t *counts, double sum)
+{
+	LatencyHistogram histogram;
+	for (int i = 0; i < N_BUCKETS; ++i)
+	{
+		histogram.buckets_[i] = counts[i];
+		histogram.count_ += counts[i];
+	}
+	histogram.sum_ = sum;
+	return histogram;
+}
+
+void LatencyHistogram::add(float ms)
+{
+	buckets_[bucket_of(ms)]++;
+	count_++;
+	sum_ += ms;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+	for (int i = 0; i < N_BUCKETS; ++i)
+		buckets_[i] += other.buckets_[i];
+	count_ += other.count_;
+	sum_ += other.sum_;
+}
+
+float LatencyHistogram::percentile(float p) const
+{
+	if (count_ == 0)
+		return 0.0f;
+
+	uint64_t rank = static_cast<uint64_t>(std::ceil(p / 100.0f * count_));
+	rank = std::max<uint64_t>(rank, 1);
+
+	uint64_t seen = 0;
+	for (int i = 0; i < N_BUCKETS - 1; ++i)
+	{
+		seen += buckets_[i];
+		if (seen >= rank)
+			return bound(i);
+	}
+
+	// Beyond the last bound: the mean is the best finite answer left
+	return static_cast<float>(sum_ / count_);
+}
+
+float percentile(std::vector<float> values, float p)
+{
+	if (values.empty())
+		return 0.0f;
+
+	size_t rank = static_cast<size_t>(std::ceil(p / 100.0f * values.size()));
+	rank = std::clamp<size_t>(rank, 1, values.size()) - 1;
+	std::nth_element(values.begin(), values.begin() + rank, values.end());
+	return values[rank];
+}
+
+void GenerationStats::merge(const GenerationStats &other)
+{
+	requests += other.requests;
+	prompt_tokens += other.prompt_tokens;
+	prefill_tokens += other.prefill_tokens;
+	generated_tokens += other.generated_tokens;
+	queue_ms += other.queue_ms;
+	prefill_ms += other.prefill_ms;
+	decode_ms += other.decode_ms;
+	first_token_ms.merge(other.first_token_ms);
+	token_ms.merge(other.token_ms);
+}
+
+void SchedulerLoad::merge(const SchedulerLoad &other)
+{
+	queued += other.queued;
+	active += other.active;
+	kv_used += other.kv_used;
+	kv_size += other.kv_size;
+}
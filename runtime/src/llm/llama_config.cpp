@@ -21,8 +21,62 @@ LlamaConfig LlamaConfig::from_file(const std::string &path)
 		config.model_path = j["model_path"];
 	if (j.contains("n_threads"))
 		config.n_threads = j["n_threads"];
+	if (j.contains("n_threads_batch"))
+		config.n_threads_batch = j["n_threads_batch"];
+	if (j.contains("numa"))
+		config.numa = j["numa"];
+	if (j.contains("autotune"))
+		config.autotune = j["autotune"];
+	if (j.contains("autotune_cache"))
+		config.autotune_cache = j["autotune_cache"];
 	if (j.contains("n_ctx"))
 		config.n_ctx = j["n_ctx"];
+	if (j.contains("n_batch"))
+		config.n_batch = j["n_batch"];
+	if (j.contains("n_ubatch"))
+		config.n_ubatch = j["n_ubatch"];
+	if (j.contains("use_mmap"))
+		config.use_mmap = j["use_mmap"];
+	if (j.contains("use_mlock"))
+		config.use_mlock = j["use_mlock"];
+	if (j.contains("prefetch"))
+		config.prefetch = j["prefetch"];
+	if (j.contains("hugepages"))
+		config.hugepages = j["hugepages"];
+	if (j.contains("warmup"))
+		config.warmup = j["warmup"];
+	if (j.contains("n_parallel"))
+		config.n_parallel = j["n_parallel"];
+	if (j.contains("cache_type_k"))
+		config.cache_type_k = j["cache_type_k"];
+	if (j.contains("cache_type_v"))
+		config.cache_type_v = j["cache_type_v"];
+	if (j.contains("flash_attn"))
+		config.flash_attn = j["flash_attn"];
+	if (j.contains("memory_budget_mb"))
+		config.memory_budget_mb = j["memory_budget_mb"];
+	if (j.contains("n_contexts"))
+		config.n_contexts = j["n_contexts"];
+	if (j.contains("n_threads_per_context"))
+		config.n_threads_per_context = j["n_threads_per_context"];
+	if (j.contains("session_cache_mb"))
+		config.session_cache_mb = j["session_cache_mb"];
+	if (j.contains("context_shift"))
+		config.context_shift = j["context_shift"];
+	if (j.contains("n_keep"))
+		config.n_keep = j["n_keep"];
+	if (j.contains("warm_prompts"))
+		config.warm_prompts = j["warm_prompts"].get<std::vector<std::string>>();
+	if (j.contains("prompt_cache_dir"))
+		config.prompt_cache_dir = j["prompt_cache_dir"];
+	if (j.contains("draft_model_path"))
+		config.draft_model_path = j["draft_model_path"];
+	if (j.contains("n_draft"))
+		config.n_draft = j["n_draft"];
+	if (j.contains("prompt_lookup"))
+		config.prompt_lookup = j["prompt_lookup"];
+	if (j.contains("lookup_ngram"))
+		config.lookup_ngram = j["lookup_ngram"];
 	if (j.contains("max_tokens"))
 		config.max_tokens = j["max_tokens"];
 	if (j.contains("temperature"))
@@ -31,8 +85,45 @@ LlamaConfig LlamaConfig::from_file(const std::string &path)
 		config.top_p = j["top_p"];
 	if (j.contains("top_k"))
 		config.top_k = j["top_k"];
+	if (j.contains("repeat_penalty"))
+		config.repeat_penalty = j["repeat_penalty"];
+	if (j.contains("repeat_last_n"))
+		config.repeat_last_n = j["repeat_last_n"];
+	if (j.contains("seed"))
+		config.seed = j["seed"];
+	if (j.contains("stop_sequences"))
+		config.stop_sequences = j["stop_sequences"].get<std::vector<std::string>>();
+	if (j.contains("system_prompt"))
+		config.system_prompt = j["system_prompt"];
 	if (j.contains("verbose"))
 		config.verbose = j["verbose"];
+	if (j.contains("log_level"))
+		config.log_level = j["log_level"];
+	if (j.contains("log_file"))
+		config.log_file = j["log_file"];
+	if (j.contains("log_format"))
+		config.log_format = j["log_format"];
+	if (j.contains("log_body_bytes"))
+		config.log_body_bytes = j["log_body_bytes"];
+	if (j.contains("trace_dir"))
+		config.trace_dir = j["trace_dir"];
+	if (j.contains("trace_sample_rate"))
+		config.trace_sample_rate = j["trace_sample_rate"];
+	if (j.contains("tool_threads"))
+		config.tool_threads = j["tool_threads"];
+	if (j.contains("tool_max_concurrent"))
+		config.tool_max_concurrent = j["tool_max_concurrent"];
+	if (j.contains("tool_timeout_ms"))
+		config.tool_timeout_ms = j["tool_timeout_ms"];
+	if (j.contains("tool_limits"))
+	{
+		for (const auto &[tool, limits] : j["tool_limits"].items())
+		{
+			ToolLimitConfig &limit = config.tool_limits[tool];
+			limit.max_concurrent = limits.value("max_concurrent", config.tool_max_concurrent);
+			limit.timeout_ms = limits.value("timeout_ms", config.tool_timeout_ms);
+		}
+	}
 
 	return config;
 }
@@ -42,14 +133,56 @@ void LlamaConfig::save_to_file(const std::string &path) const
 	json j;
 	j["model_path"] = model_path;
 	j["n_threads"] = n_threads;
+	j["n_threads_batch"] = n_threads_batch;
+	j["numa"] = numa;
+	j["autotune"] = autotune;
+	j["autotune_cache"] = autotune_cache;
 	j["n_ctx"] = n_ctx;
 	j["n_batch"] = n_batch;
+	j["n_ubatch"] = n_ubatch;
+	j["use_mmap"] = use_mmap;
+	j["use_mlock"] = use_mlock;
+	j["prefetch"] = prefetch;
+	j["hugepages"] = hugepages;
+	j["warmup"] = warmup;
+	j["n_parallel"] = n_parallel;
+	j["cache_type_k"] = cache_type_k;
+	j["cache_type_v"] = cache_type_v;
+	j["flash_attn"] = flash_attn;
+	j["memory_budget_mb"] = memory_budget_mb;
+	j["n_contexts"] = n_contexts;
+	j["n_threads_per_context"] = n_threads_per_context;
+	j["session_cache_mb"] = session_cache_mb;
+	j["context_shift"] = context_shift;
+	j["n_keep"] = n_keep;
+	j["warm_prompts"] = warm_prompts;
+	j["prompt_cache_dir"] = prompt_cache_dir;
+	j["draft_model_path"] = draft_model_path;
+	j["n_draft"] = n_draft;
+	j["prompt_lookup"] = prompt_lookup;
+	j["lookup_ngram"] = lookup_ngram;
 	j["max_tokens"] = max_tokens;
 	j["temperature"] = temperature;
 	j["top_p"] = top_p;
 	j["top_k"] = top_k;
 	j["repeat_penalty"] = repeat_penalty;
+	j["repeat_last_n"] = repeat_last_n;
+	j["seed"] = seed;
+	j["stop_sequences"] = stop_sequences;
+	j["system_prompt"] = system_prompt;
 	j["verbose"] = verbose;
+	j["log_level"] = log_level;
+	j["log_file"] = log_file;
+	j["log_format"] = log_format;
+	j["log_body_bytes"] = log_body_bytes;
+	j["trace_dir"] = trace_dir;
+	j["trace_sample_rate"] = trace_sample_rate;
+	j["tool_threads"] = tool_threads;
+	j["tool_max_concurrent"] = tool_max_concurrent;
+	j["tool_timeout_ms"] = tool_timeout_ms;
+	j["tool_limits"] = json::object();
+	for (const auto &[tool, limit] : tool_limits)
+		j["tool_limits"][tool] = {{"max_concurrent", limit.max_concurrent}, {"timeout_ms", limit.timeout_ms}};
 
 	std::ofstream file(path);
 	file << j.dump(2);
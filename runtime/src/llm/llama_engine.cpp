@@ -1,11 +1,75 @@
 #include "llm/llama_engine.h"
+#include "core/logger.h"
+#include "core/trace.h"
+#include "llm/autotuner.h"
+#include "llm/batch_scheduler.h"
+#include "llm/model_prefetch.h"
 #include "llama.h"
-#include <iostream>
+#include <algorithm>
 #include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
 #include <sstream>
 
+static constexpr uint64_t FNV_OFFSET = 14695981039346656037ull;
+static constexpr uint64_t FNV_PRIME = 1099511628211ull;
+
+static uint64_t fnv1a(const void *data, size_t size, uint64_t hash = FNV_OFFSET)
+{
+	const auto *bytes = static_cast<const unsigned char *>(data);
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+// Identifies a model file without reading all of it: the size plus the
+// first and last MiB, which cover the GGUF header, metadata and tensor
+// table. Copies of the same file hash the same; any re-quantization or
+// different weights change it.
+static uint64_t fingerprint_model_file(const std::string &path)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file.is_open())
+		return 0;
+
+	uint64_t size = static_cast<uint64_t>(file.tellg());
+	uint64_t hash = fnv1a(&size, sizeof(size));
+
+	const size_t chunk = 1 << 20;
+	std::vector<char> buf(chunk);
+
+	for (uint64_t offset : {uint64_t(0), size > chunk ? size - chunk : uint64_t(0)})
+	{
+		file.seekg(offset);
+		file.read(buf.data(), chunk);
+		hash = fnv1a(buf.data(), static_cast<size_t>(file.gcount()), hash);
+		file.clear();
+	}
+
+	return hash;
+}
+
+static bool numa_strategy(const std::string &name, ggml_numa_strategy &strategy)
+{
+	if (name == "disabled" || name.empty())
+		strategy = GGML_NUMA_STRATEGY_DISABLED;
+	else if (name == "distribute")
+		strategy = GGML_NUMA_STRATEGY_DISTRIBUTE;
+	else if (name == "isolate")
+		strategy = GGML_NUMA_STRATEGY_ISOLATE;
+	else if (name == "numactl")
+		strategy = GGML_NUMA_STRATEGY_NUMACTL;
+	else
+		return false;
+	return true;
+}
+
 LlamaEngine::LlamaEngine(const LlamaConfig &config)
-		: config_(config), model_(nullptr), ctx_(nullptr), sampler_(nullptr)
+		: config_(config), model_(nullptr), model_hash_(0), n_system_tokens_(0)
 {
 }
 
@@ -18,15 +82,37 @@ bool LlamaEngine::load()
 {
 	if (is_loaded())
 	{
-		std::cerr << "[LlamaEngine] Already loaded\n";
+		LOG_WARN("LlamaEngine", "Already loaded");
 		return true;
 	}
 
-	std::cout << "[LlamaEngine] Loading model: " << config_.model_path << "\n";
+	LOG_INFO("LlamaEngine", "Loading model: " << config_.model_path);
+
+	ggml_numa_strategy numa;
+	if (!numa_strategy(config_.numa, numa))
+	{
+		LOG_ERROR("LlamaEngine", "Unknown NUMA strategy " << config_.numa
+							<< " (use disabled, distribute, isolate or numactl)");
+		return false;
+	}
+
+	auto load_start = std::chrono::steady_clock::now();
+
+	// Start reading the weights while the backend and model are set up.
+	// Under NUMA the pages are only advised, so the threads that fault
+	// them in during warmup place them on their own nodes.
+	ModelPrefetch prefetch;
+	if (config_.prefetch)
+	{
+		std::vector<std::string> paths = {config_.model_path};
+		if (!config_.draft_model_path.empty())
+			paths.push_back(config_.draft_model_path);
+		prefetch.start(paths, numa == GGML_NUMA_STRATEGY_DISABLED, config_.hugepages);
+	}
 
 	// Initialize llama backend
 	llama_backend_init();
-	llama_numa_init(GGML_NUMA_STRATEGY_DISABLED);
+	llama_numa_init(numa);
 
 	// Model parameters
 	llama_model_params model_params = llama_model_default_params();
@@ -37,99 +123,131 @@ bool LlamaEngine::load()
 	model_ = llama_load_model_from_file(config_.model_path.c_str(), model_params);
 	if (!model_)
 	{
-		std::cerr << "[LlamaEngine] Failed to load model\n";
+		LOG_ERROR("LlamaEngine", "Failed to load model");
 		return false;
 	}
 
-	// Initialize sampler
-	init_sampler(config_.temperature);
-
-	std::cout << "[LlamaEngine] Model loaded successfully\n";
-	std::cout << "[LlamaEngine] Threads: " << config_.n_threads << "\n";
+	if (kv_cache_type(config_.cache_type_k) < 0 || kv_cache_type(config_.cache_type_v) < 0)
+	{
+		LOG_ERROR("LlamaEngine", "Unknown KV cache type " << config_.cache_type_k << "/" << config_.cache_type_v
+							<< " (use f32, f16, q8_0 or q4_0)");
+		llama_free_model(model_);
+		model_ = nullptr;
+		return false;
+	}
 
-	// Note: context will be created on first generation
-	return true;
-}
+	model_hash_ = fingerprint_model_file(config_.model_path);
 
-void LlamaEngine::unload()
-{
-	if (sampler_)
+	if (config_.autotune)
 	{
-		llama_sampler_free(sampler_);
-		sampler_ = nullptr;
+		TuneResult tuned;
+		if (autotune(model_, config_, model_hash_, tuned))
+		{
+			// Tuned per context; the split below hands each its share
+			int n_contexts = std::max(1, config_.n_contexts);
+			config_.n_threads = tuned.n_threads * n_contexts;
+			config_.n_threads_batch = tuned.n_threads_batch * n_contexts;
+			config_.n_threads_per_context = 0;
+			config_.n_ubatch = tuned.n_ubatch;
+			config_.n_batch = std::max(config_.n_batch, tuned.n_ubatch);
+
+			LOG_INFO("LlamaEngine", "Autotune" << (tuned.cached ? " (cached)" : "") << ": "
+								<< tuned.n_threads << " decode threads (" << tuned.decode_tps << " t/s), "
+								<< tuned.n_threads_batch << " prefill threads, n_ubatch " << tuned.n_ubatch
+								<< " (" << tuned.prefill_tps << " t/s)");
+		}
 	}
 
-	if (ctx_)
+	// Fit context size, sequences and KV cache type into the memory budget
+	plan_ = plan_memory(model_, config_);
+	apply_memory_plan(plan_, config_);
+
+	auto mb = [](uint64_t bytes)
 	{
-		llama_free(ctx_);
-		ctx_ = nullptr;
+		return bytes >> 20;
+	};
+	LOG_INFO("LlamaEngine", "Memory plan: " << plan_.n_contexts << " x " << plan_.n_parallel << " x "
+						<< plan_.n_ctx << " tokens, KV " << plan_.cache_type_k << "/" << plan_.cache_type_v
+						<< (plan_.flash_attn ? ", flash attention" : ""));
+	LOG_INFO("LlamaEngine", "Memory estimate: " << mb(plan_.total_bytes()) << " MiB (weights "
+						<< mb(plan_.weights_bytes) << ", KV " << mb(plan_.kv_bytes) << ", compute "
+						<< mb(plan_.compute_bytes) << ", sessions " << mb(plan_.session_bytes) << ")"
+						<< (plan_.budget_bytes > 0 ? " of " + std::to_string(mb(plan_.budget_bytes)) + " MiB budget" : ""));
+	if (!plan_.fits)
+		LOG_WARN("LlamaEngine", "Even the smallest layout exceeds memory_budget_mb");
+
+	n_system_tokens_ = static_cast<int>(tokenize(config_.system_prompt + "\n\n", true).size());
+
+	// One context, set of slots and decode thread per pool entry, all on
+	// the same weights. The thread budget is split between them.
+	int n_contexts = std::max(1, config_.n_contexts);
+
+	LlamaConfig context_config = config_;
+	if (config_.n_threads_per_context > 0)
+	{
+		context_config.n_threads = config_.n_threads_per_context;
+		context_config.n_threads_batch = config_.n_threads_per_context;
 	}
-
-	if (model_)
+	else
 	{
-		llama_free_model(model_);
-		model_ = nullptr;
+		context_config.n_threads = std::max(1, config_.n_threads / n_contexts);
+		context_config.n_threads_batch = std::max(1, config_.n_threads_batch / n_contexts);
 	}
 
-	llama_backend_free();
-}
-
-bool LlamaEngine::ensure_context()
-{
-	if (ctx_)
-		return true;
+	// Parked sessions live in the context they belong to
+	context_config.session_cache_mb = config_.session_cache_mb / n_contexts;
 
-	// Create context lazily
-	llama_context_params ctx_params = llama_context_default_params();
-	ctx_params.n_ctx = config_.n_ctx;
-	ctx_params.n_batch = config_.n_batch;
-	ctx_params.n_ubatch = config_.n_ubatch;
-	ctx_params.n_threads = config_.n_threads;
-	ctx_params.n_threads_batch = config_.n_threads_batch;
-
-	ctx_ = llama_new_context_with_model(model_, ctx_params);
-	if (!ctx_)
+	for (int i = 0; i < n_contexts; ++i)
 	{
-		std::cerr << "[LlamaEngine] Failed to create context\n";
-		return false;
+		auto scheduler = std::make_unique<BatchScheduler>(model_, context_config);
+		if (!scheduler->start())
+		{
+			schedulers_.clear();
+			llama_free_model(model_);
+			model_ = nullptr;
+			return false;
+		}
+		schedulers_.push_back(std::move(scheduler));
 	}
 
-	if (config_.verbose)
-	{
-		std::cout << "[LlamaEngine] Context created: " << config_.n_ctx << " tokens\n";
-	}
+	uint64_t prefetched = prefetch.wait();
+
+	LOG_INFO("LlamaEngine", "Model loaded successfully in "
+						<< std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - load_start).count()
+						<< " ms"
+						<< (prefetched > 0 ? " (" + std::to_string(prefetched >> 20) + " MiB prefetched)" : ""));
+	if (numa != GGML_NUMA_STRATEGY_DISABLED)
+		LOG_INFO("LlamaEngine", "NUMA: " << config_.numa);
+	LOG_INFO("LlamaEngine", "Contexts: " << n_contexts << " x " << context_config.n_threads << " threads");
+	LOG_INFO("LlamaEngine", "Parallel sequences: " << parallel_slots());
+	if (schedulers_[0]->has_draft_model())
+		LOG_INFO("LlamaEngine", "Speculative decoding: up to " << config_.n_draft << " draft tokens");
+
+	for (const auto &prefix : config_.warm_prompts)
+		warm_prompt(prefix);
 
 	return true;
 }
 
-void LlamaEngine::reset_context()
+void LlamaEngine::unload()
 {
-	// Recreate context to clear state
-	if (ctx_)
+	// Stops the decode threads and frees the contexts
+	schedulers_.clear();
+
+	if (model_)
 	{
-		llama_free(ctx_);
-		ctx_ = nullptr;
+		llama_free_model(model_);
+		model_ = nullptr;
 	}
-	ensure_context();
-}
-
-void LlamaEngine::init_sampler(float temperature)
-{
-	if (sampler_)
-		llama_sampler_free(sampler_);
-
-	float temp = temperature > 0 ? temperature : config_.temperature;
-
-	sampler_ = llama_sampler_chain_init(llama_sampler_chain_default_params());
 
-	llama_sampler_chain_add(sampler_, llama_sampler_init_top_k(config_.top_k));
-	llama_sampler_chain_add(sampler_, llama_sampler_init_top_p(config_.top_p, 1));
-	llama_sampler_chain_add(sampler_, llama_sampler_init_temp(temp));
-	llama_sampler_chain_add(sampler_, llama_sampler_init_dist(LLAMA_DEFAULT_SEED));
+	llama_backend_free();
 }
 
 std::vector<int> LlamaEngine::tokenize(const std::string &text, bool add_bos)
 {
+	TraceSpan span("tokenize", "llm");
+	span.arg("bytes", text.size());
+
 	const llama_vocab *vocab = llama_model_get_vocab(model_);
 
 	int n_tokens = text.length() + (add_bos ? 1 : 0) + 1;
@@ -179,163 +297,178 @@ std::string LlamaEngine::detokenize(const std::vector<int> &tokens)
 	return result;
 }
 
-bool LlamaEngine::check_stop_sequence(
-		const std::string &text,
-		const std::vector<std::string> &stops)
-{
-	for (const auto &stop : stops)
-	{
-		if (text.length() >= stop.length())
-		{
-			if (text.substr(text.length() - stop.length()) == stop)
-				return true;
-		}
-	}
-	return false;
-}
-
 GenerateResult LlamaEngine::generate(
 		const std::string &prompt,
 		int max_tokens,
 		float temperature,
-		const std::vector<std::string> &stop)
+		const std::vector<std::string> &stop,
+		const TokenCallback &on_token)
+{
+	GenerateOptions options;
+	options.max_tokens = max_tokens;
+	options.temperature = temperature;
+	options.stop = stop;
+	options.on_token = on_token;
+	return generate(prompt, options);
+}
+
+GenerateResult LlamaEngine::generate(const std::string &prompt, const GenerateOptions &options)
 {
 	if (!model_)
 	{
 		throw std::runtime_error("Model not loaded");
 	}
 
-	GenerateResult result;
-	result.tokens_generated = 0;
-	result.stopped_by_limit = false;
-	result.stop_reason = "completed";
+	return generate_tokens(tokenize(prompt, true), options);
+}
 
-	try
+GenerateResult LlamaEngine::generate_tokens(std::vector<int> tokens, const GenerateOptions &options)
+{
+	if (!model_)
 	{
-		// Ensure we have a fresh context for each generation
-		// This is necessary because transitional llama.cpp lacks proper KV cache clear APIs
-		std::cout << "[LlamaEngine] Starting generation...\n"
-							<< std::flush;
-		reset_context();
-		if (!ctx_)
-		{
-			throw std::runtime_error("Failed to create context");
-		}
-		std::cout << "[LlamaEngine] Context ready\n"
-							<< std::flush;
-
-		int max_gen = max_tokens > 0 ? max_tokens : config_.max_tokens;
-		auto stops = stop.empty() ? config_.stop_sequences : stop;
+		throw std::runtime_error("Model not loaded");
+	}
 
-		// Reinit sampler if temperature changed
-		if (temperature > 0 && std::abs(temperature - config_.temperature) > 0.01f)
-		{
-			init_sampler(temperature);
-		}
+	TraceSpan span("generate", "llm");
+
+	auto task = std::make_shared<GenerationTask>();
+	task->submitted = std::chrono::steady_clock::now();
+	if (Trace::current())
+		task->trace = Trace::current()->shared_from_this();
+	task->tokens = std::move(tokens);
+	task->max_tokens = options.max_tokens;
+	task->stop = options.stop.empty() ? config_.stop_sequences : options.stop;
+	task->on_token = options.on_token;
+	task->session_id = options.session_id;
+	task->prompt_lookup = options.prompt_lookup < 0 ? config_.prompt_lookup : options.prompt_lookup > 0;
+	task->grammar = options.grammar;
+	task->stop_at_json_end = options.stop_at_json_end;
+	task->n_keep = options.n_keep >= 0 ? options.n_keep : config_.n_keep >= 0 ? config_.n_keep : n_system_tokens_;
+
+	SamplingParams &sampling = task->sampling;
+	sampling.temperature = options.temperature >= 0 ? options.temperature : config_.temperature;
+	sampling.top_k = options.top_k >= 0 ? options.top_k : config_.top_k;
+	sampling.top_p = options.top_p >= 0 ? options.top_p : config_.top_p;
+	sampling.repeat_penalty = options.repeat_penalty > 0 ? options.repeat_penalty : config_.repeat_penalty;
+	sampling.repeat_last_n = config_.repeat_last_n;
+
+	int64_t seed = options.seed >= 0 ? options.seed : config_.seed;
+	sampling.seed = seed >= 0 ? static_cast<uint32_t>(seed) : LLAMA_DEFAULT_SEED;
+
+	// Everything else in the result starts out zeroed
+	task->result.stop_reason = "completed";
+	task->result.prompt_tokens = task->tokens.size();
+
+	LOG_DEBUG("LlamaEngine", "Starting generation...");
+
+	// The scheduler thread decodes this alongside any other active requests
+	pick_scheduler(task->session_id).submit(task);
+	task->wait();
+
+	span.arg("prompt_tokens", task->result.prompt_tokens);
+	span.arg("cached_tokens", task->result.cached_tokens);
+	span.arg("tokens_generated", task->result.tokens_generated);
+	return task->result;
+}
 
-		// Tokenize prompt
-		auto tokens = tokenize(prompt, true);
+void LlamaEngine::end_session(const std::string &session_id)
+{
+	if (!schedulers_.empty() && !session_id.empty())
+		pick_scheduler(session_id).end_session(session_id);
+}
 
-		if (config_.verbose)
-		{
-			std::cout << "[LlamaEngine] Prompt tokens: " << tokens.size() << "\n";
-		}
+BatchScheduler &LlamaEngine::pick_scheduler(const std::string &session_id)
+{
+	// A conversation always returns to the context holding its KV state
+	if (!session_id.empty())
+		return *schedulers_[std::hash<std::string>{}(session_id) % schedulers_.size()];
 
-		auto start_time = std::chrono::high_resolution_clock::now();
+	// Anything else goes wherever the fewest requests are queued or running
+	BatchScheduler *best = schedulers_[0].get();
+	for (const auto &scheduler : schedulers_)
+	{
+		if (scheduler->load() < best->load())
+			best = scheduler.get();
+	}
+	return *best;
+}
 
-		// Evaluate prompt in batches
-		for (size_t i = 0; i < tokens.size(); i += config_.n_batch)
-		{
-			size_t n_eval = std::min((size_t)config_.n_batch, tokens.size() - i);
+bool LlamaEngine::warm_prompt(const std::string &prefix)
+{
+	if (!model_)
+		return false;
 
-			if (llama_decode(ctx_, llama_batch_get_one(&tokens[i], n_eval)))
-			{
-				throw std::runtime_error("Failed to evaluate prompt");
-			}
-		}
+	std::vector<int> tokens = tokenize(prefix, true);
+	std::string path = snapshot_path(tokens);
 
-		const llama_vocab *vocab = llama_model_get_vocab(model_);
+	// Every context needs the prefix in its own KV cache. One after the
+	// other, so the first one's snapshot is there for the rest to load.
+	for (auto &scheduler : schedulers_)
+	{
+		auto task = std::make_shared<GenerationTask>();
+		task->submitted = std::chrono::steady_clock::now();
+		task->tokens = tokens;
+		task->prefill_only = true;
+		task->snapshot_path = path;
+		task->result.prompt_tokens = task->tokens.size();
+
+		scheduler->submit(task);
+		task->wait();
+
+		const auto &result = task->result;
+		if (result.stop_reason == "error")
+			return false;
+
+		LOG_INFO("LlamaEngine", "Warmed " << result.prompt_tokens << " prompt tokens ("
+							<< result.stop_reason << ", " << result.total_ms << " ms)");
+	}
+	return true;
+}
 
-		// Generate tokens
-		std::vector<int> generated_tokens;
-		std::string generated_text;
+bool LlamaEngine::warm_chat(const std::vector<json> &messages)
+{
+	return warm_prompt(format_chat(messages, true, false));
+}
 
-		for (int i = 0; i < max_gen; ++i)
-		{
-			int token = llama_sampler_sample(sampler_, ctx_, -1);
-
-			// Check for EOS
-			if (llama_vocab_is_eog(vocab, token))
-			{
-				result.stop_reason = "eos";
-				break;
-			}
-
-			generated_tokens.push_back(token);
-
-			// Decode token
-			char buf[128];
-			int n = llama_token_to_piece(vocab, token, buf, sizeof(buf), 0, false);
-			if (n > 0)
-			{
-				generated_text.append(buf, n);
-			}
-
-			// Check stop sequences
-			if (check_stop_sequence(generated_text, stops))
-			{
-				result.stop_reason = "stop_sequence";
-				break;
-			}
-
-			// Evaluate next token
-			if (llama_decode(ctx_, llama_batch_get_one(&token, 1)))
-			{
-				throw std::runtime_error("Failed to evaluate token");
-			}
-
-			result.tokens_generated++;
-
-			if (i == max_gen - 1)
-			{
-				result.stopped_by_limit = true;
-				result.stop_reason = "length";
-			}
-		}
+std::string LlamaEngine::snapshot_path(const std::vector<int> &tokens) const
+{
+	if (config_.prompt_cache_dir.empty() || model_hash_ == 0)
+		return "";
 
-		auto end_time = std::chrono::high_resolution_clock::now();
-		auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
+	std::error_code ec;
+	std::filesystem::create_directories(config_.prompt_cache_dir, ec);
+	if (ec)
+	{
+		LOG_ERROR("LlamaEngine", "Cannot create " << config_.prompt_cache_dir << ": " << ec.message());
+		return "";
+	}
 
-		result.text = generated_text;
-		result.tokens_per_second = result.tokens_generated / (duration.count() / 1000.0f);
+	uint64_t prompt_hash = fnv1a(tokens.data(), tokens.size() * sizeof(int));
 
-		std::cout << "[LlamaEngine] Generation complete: " << result.tokens_generated
-							<< " tokens, " << result.tokens_per_second << " t/s\n"
-							<< std::flush;
+	// A state saved with other KV cache types cannot be loaded
+	std::string cache_types = config_.cache_type_k + "/" + config_.cache_type_v;
+	uint64_t model_hash = fnv1a(cache_types.data(), cache_types.size(), model_hash_);
 
-		if (config_.verbose)
-		{
-			std::cout << "[LlamaEngine] Generated " << result.tokens_generated
-								<< " tokens in " << duration.count() << "ms"
-								<< " (" << result.tokens_per_second << " t/s)\n";
-		}
-	}
-	catch (const std::exception &e)
-	{
-		std::cerr << "[LlamaEngine] Generation error: " << e.what() << "\n";
-		result.text = "";
-		result.stop_reason = "error";
-		// Don't rethrow - return error result instead
-	}
+	char name[64];
+	std::snprintf(name, sizeof(name), "%016llx-%016llx.state",
+								static_cast<unsigned long long>(model_hash),
+								static_cast<unsigned long long>(prompt_hash));
 
-	return result;
+	return (std::filesystem::path(config_.prompt_cache_dir) / name).string();
 }
 
-std::string LlamaEngine::build_chat_prompt(const std::vector<json> &messages)
+std::string LlamaEngine::format_chat(
+		const std::vector<json> &messages,
+		bool with_system_prompt,
+		bool add_assistant_turn)
 {
+	TraceSpan span("format_chat", "llm");
+	span.arg("messages", messages.size());
+
 	std::ostringstream oss;
 
-	oss << config_.system_prompt << "\n\n";
+	if (with_system_prompt)
+		oss << config_.system_prompt << "\n\n";
 
 	for (const auto &msg : messages)
 	{
@@ -354,9 +487,14 @@ std::string LlamaEngine::build_chat_prompt(const std::vector<json> &messages)
 		{
 			oss << "Assistant: " << content << "\n\n";
 		}
+		else if (role == "tool")
+		{
+			oss << "Tool (" << msg.value("name", "") << "): " << content << "\n\n";
+		}
 	}
 
-	oss << "Assistant:";
+	if (add_assistant_turn)
+		oss << "Assistant:";
 	return oss.str();
 }
 
@@ -365,8 +503,18 @@ GenerateResult LlamaEngine::chat(
 		int max_tokens,
 		float temperature)
 {
-	std::string prompt = build_chat_prompt(messages);
-	return generate(prompt, max_tokens, temperature);
+	GenerateOptions options;
+	options.max_tokens = max_tokens;
+	options.temperature = temperature;
+	return chat(messages, options);
+}
+
+GenerateResult LlamaEngine::chat(const std::vector<json> &messages, const GenerateOptions &options)
+{
+	// The prompt is rebuilt in full, but with a session_id everything up to
+	// the newly appended messages is still in the KV cache
+	std::string prompt = format_chat(messages, true, true);
+	return generate(prompt, options);
 }
 
 std::string LlamaEngine::model_name() const
@@ -384,6 +532,53 @@ int LlamaEngine::context_size() const
 	return config_.n_ctx;
 }
 
+int LlamaEngine::parallel_slots() const
+{
+	int n = 0;
+	for (const auto &scheduler : schedulers_)
+		n += scheduler->n_slots();
+	return n;
+}
+
+int LlamaEngine::decode_threads() const
+{
+	int n_contexts = std::max(1, config_.n_contexts);
+	if (config_.n_threads_per_context > 0)
+		return config_.n_threads_per_context * n_contexts;
+	return std::max(n_contexts, config_.n_threads);
+}
+
+SessionStats LlamaEngine::session_stats() const
+{
+	SessionStats total;
+	for (const auto &scheduler : schedulers_)
+	{
+		SessionStats stats = scheduler->session_stats();
+		total.hits += stats.hits;
+		total.misses += stats.misses;
+		total.evictions += stats.evictions;
+		total.parked += stats.parked;
+		total.parked_bytes += stats.parked_bytes;
+	}
+	return total;
+}
+
+GenerationStats LlamaEngine::generation_stats() const
+{
+	GenerationStats total;
+	for (const auto &scheduler : schedulers_)
+		total.merge(scheduler->generation_stats());
+	return total;
+}
+
+SchedulerLoad LlamaEngine::current_load() const
+{
+	SchedulerLoad total;
+	for (const auto &scheduler : schedulers_)
+		total.merge(scheduler->current_load());
+	return total;
+}
+
 int LlamaEngine::vocab_size() const
 {
 	if (!model_)
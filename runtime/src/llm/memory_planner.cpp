@@ -0,0 +1,198 @@
+#include "llm/memory_planner.h"
+#include "llama.h"
+#include <algorithm>
+#include <filesystem>
+
+// Cache types from most to least precise
+static const struct
+{
+	const char *name;
+	ggml_type type;
+} KV_CACHE_TYPES[] = {
+		{"f32", GGML_TYPE_F32},
+		{"f16", GGML_TYPE_F16},
+		{"q8_0", GGML_TYPE_Q8_0},
+		{"q4_0", GGML_TYPE_Q4_0},
+};
+
+static constexpr int N_KV_CACHE_TYPES = sizeof(KV_CACHE_TYPES) / sizeof(KV_CACHE_TYPES[0]);
+
+// The planner does not go below these
+static constexpr int MIN_CTX = 512;
+static constexpr int MAX_AUTO_PARALLEL = 64;
+
+// llama.cpp rounds the KV cache up to a multiple of this many cells
+static constexpr uint64_t KV_PADDING = 256;
+
+// Activations per batch token, in floats per embedding value: the
+// residual stream, attention and feed-forward temporaries. A rough upper
+// estimate; llama.cpp reuses most of them between layers.
+static constexpr uint64_t ACTIVATION_FACTOR = 16;
+
+static int type_index(const std::string &name)
+{
+	for (int i = 0; i < N_KV_CACHE_TYPES; ++i)
+	{
+		if (name == KV_CACHE_TYPES[i].name)
+			return i;
+	}
+	return -1;
+}
+
+int kv_cache_type(const std::string &name)
+{
+	int i = type_index(name);
+	return i < 0 ? -1 : KV_CACHE_TYPES[i].type;
+}
+
+namespace
+{
+	struct ModelShape
+	{
+		uint64_t n_layer;
+		uint64_t n_embd;
+		uint64_t n_head;
+		uint64_t n_embd_kv; // K (and V) values per token and layer, with GQA
+		uint64_t n_vocab;
+	};
+
+	struct Layout
+	{
+		int n_ctx;
+		int n_parallel;
+		int k; // into KV_CACHE_TYPES
+		int v;
+	};
+}
+
+// Fills in the layout-dependent part of plan
+static void estimate(const ModelShape &shape, const LlamaConfig &config, const Layout &layout, MemoryPlan &plan)
+{
+	ggml_type type_k = KV_CACHE_TYPES[layout.k].type;
+	ggml_type type_v = KV_CACHE_TYPES[layout.v].type;
+
+	plan.n_ctx = layout.n_ctx;
+	plan.n_parallel = layout.n_parallel;
+	plan.cache_type_k = KV_CACHE_TYPES[layout.k].name;
+	plan.cache_type_v = KV_CACHE_TYPES[layout.v].name;
+	plan.flash_attn = config.flash_attn || (type_v != GGML_TYPE_F32 && type_v != GGML_TYPE_F16);
+
+	uint64_t n_cells = (uint64_t)layout.n_ctx * layout.n_parallel;
+	n_cells = (n_cells + KV_PADDING - 1) / KV_PADDING * KV_PADDING;
+
+	uint64_t per_cell = shape.n_layer * (ggml_row_size(type_k, shape.n_embd_kv) + ggml_row_size(type_v, shape.n_embd_kv));
+
+	// Without flash attention every head's scores against the whole cache
+	// are materialized for a micro-batch
+	uint64_t n_ubatch = std::max(1, std::min(config.n_ubatch, config.n_batch));
+	uint64_t compute = n_ubatch * shape.n_embd * sizeof(float) * ACTIVATION_FACTOR;
+	if (!plan.flash_attn)
+		compute += n_ubatch * n_cells * shape.n_head * sizeof(float);
+
+	// Logits for every slot's sampled and drafted tokens
+	uint64_t n_outputs = (uint64_t)layout.n_parallel * (1 + std::max(0, config.n_draft));
+	compute += n_outputs * shape.n_vocab * sizeof(float);
+
+	plan.kv_bytes = plan.n_contexts * n_cells * per_cell;
+	plan.compute_bytes = plan.n_contexts * compute;
+	plan.fits = plan.budget_bytes == 0 || plan.total_bytes() <= plan.budget_bytes;
+}
+
+MemoryPlan plan_memory(const llama_model *model, const LlamaConfig &config)
+{
+	ModelShape shape;
+	shape.n_layer = llama_model_n_layer(model);
+	shape.n_embd = llama_model_n_embd(model);
+	shape.n_head = std::max(1, llama_model_n_head(model));
+	shape.n_embd_kv = shape.n_embd / shape.n_head * llama_model_n_head_kv(model);
+	shape.n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(model));
+
+	MemoryPlan plan;
+	plan.n_contexts = std::max(1, config.n_contexts);
+	plan.weights_bytes = llama_model_size(model);
+	plan.session_bytes = static_cast<uint64_t>(std::max(0, config.session_cache_mb)) << 20;
+	plan.budget_bytes = static_cast<uint64_t>(std::max(0, config.memory_budget_mb)) << 20;
+
+	// The draft model's KV cache is small next to its weights, and left out
+	std::error_code ec;
+	if (!config.draft_model_path.empty() && config.n_draft > 0)
+	{
+		uint64_t size = std::filesystem::file_size(config.draft_model_path, ec);
+		if (!ec)
+			plan.weights_bytes += size;
+	}
+
+	// Unknown names were rejected before this; f16 is llama.cpp's default
+	Layout requested;
+	requested.n_ctx = config.n_ctx;
+	requested.n_parallel = std::max(1, config.n_parallel);
+	requested.k = std::max(0, type_index(config.cache_type_k));
+	requested.v = std::max(0, type_index(config.cache_type_v));
+
+	estimate(shape, config, requested, plan);
+	if (plan.budget_bytes == 0 || (plan.fits && config.n_parallel > 0))
+		return plan;
+
+	// Each cache type no more precise than what was configured
+	auto layout = [&](int n_ctx, int n_parallel, int level)
+	{
+		Layout candidate = requested;
+		candidate.n_ctx = n_ctx;
+		candidate.n_parallel = n_parallel;
+		candidate.k = std::max(requested.k, level);
+		candidate.v = std::max(requested.v, level);
+		return candidate;
+	};
+
+	auto fits = [&](const Layout &candidate)
+	{
+		MemoryPlan trial = plan;
+		estimate(shape, config, candidate, trial);
+		if (trial.fits)
+			plan = trial;
+		return trial.fits;
+	};
+
+	int min_ctx = std::min(MIN_CTX, requested.n_ctx);
+	int min_level = std::min(requested.k, requested.v);
+
+	for (int n_ctx = requested.n_ctx; n_ctx >= min_ctx; n_ctx /= 2)
+	{
+		if (config.n_parallel <= 0)
+		{
+			// As many sequences as fit, at the least quantization that fits any
+			for (int level = min_level; level < N_KV_CACHE_TYPES; ++level)
+			{
+				for (int n_parallel = MAX_AUTO_PARALLEL; n_parallel >= 1; --n_parallel)
+				{
+					if (fits(layout(n_ctx, n_parallel, level)))
+						return plan;
+				}
+			}
+			continue;
+		}
+
+		// Quantizing costs less than serving fewer requests at once
+		for (int n_parallel = requested.n_parallel; n_parallel >= 1; --n_parallel)
+		{
+			for (int level = min_level; level < N_KV_CACHE_TYPES; ++level)
+			{
+				if (fits(layout(n_ctx, n_parallel, level)))
+					return plan;
+			}
+		}
+	}
+
+	// Nothing fits: the smallest layout, and a warning from the caller
+	estimate(shape, config, layout(min_ctx, 1, N_KV_CACHE_TYPES - 1), plan);
+	return plan;
+}
+
+void apply_memory_plan(const MemoryPlan &plan, LlamaConfig &config)
+{
+	config.n_ctx = plan.n_ctx;
+	config.n_parallel = plan.n_parallel;
+	config.cache_type_k = plan.cache_type_k;
+	config.cache_type_v = plan.cache_type_v;
+	config.flash_attn = plan.flash_attn;
+}
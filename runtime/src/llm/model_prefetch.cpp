@@ -0,0 +1,70 @@
+#include "llm/model_prefetch.h"
+#include "core/logger.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+ModelPrefetch::~ModelPrefetch()
+{
+	wait();
+}
+
+void ModelPrefetch::start(std::vector<std::string> paths, bool touch, bool hugepages)
+{
+	thread_ = std::thread([this, paths = std::move(paths), touch, hugepages]()
+												{
+		for (const auto &path : paths)
+		{
+			int fd = open(path.c_str(), O_RDONLY);
+			if (fd < 0)
+				continue;
+
+			struct stat st;
+			if (fstat(fd, &st) != 0 || st.st_size == 0)
+			{
+				close(fd);
+				continue;
+			}
+
+			size_t size = static_cast<size_t>(st.st_size);
+			void *addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+			close(fd);
+			if (addr == MAP_FAILED)
+			{
+				LOG_WARN("LlamaEngine", "Cannot map " << path << " for prefetch");
+				continue;
+			}
+
+			// Both are advice; kernels without them just ignore it
+#ifdef MADV_HUGEPAGE
+			if (hugepages)
+				madvise(addr, size, MADV_HUGEPAGE);
+#else
+			(void)hugepages;
+#endif
+			madvise(addr, size, MADV_WILLNEED);
+
+			if (touch)
+			{
+				// The page cache outlives this mapping; the model's own
+				// mapping then finds every page resident
+				const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+				const volatile char *bytes = static_cast<const char *>(addr);
+				char sink = 0;
+				for (size_t offset = 0; offset < size; offset += page)
+					sink ^= bytes[offset];
+				(void)sink;
+			}
+
+			munmap(addr, size);
+			bytes_ += size;
+		} });
+}
+
+uint64_t ModelPrefetch::wait()
+{
+	if (thread_.joinable())
+		thread_.join();
+	return bytes_;
+}
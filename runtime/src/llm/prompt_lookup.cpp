@@ -0,0 +1,39 @@
+#include "llm/prompt_lookup.h"
+#include <algorithm>
+
+void prompt_lookup_draft(
+		const std::vector<int> &history,
+		int pending_token,
+		int ngram_max,
+		int n_draft,
+		std::vector<int> &draft)
+{
+	draft.clear();
+
+	// The sequence being continued is history followed by pending_token
+	size_t n_tokens = history.size() + 1;
+	auto at = [&](size_t i)
+	{
+		return i < history.size() ? history[i] : pending_token;
+	};
+
+	for (int n = std::min<int>(ngram_max, n_tokens - 1); n >= 2; --n)
+	{
+		size_t tail = n_tokens - n;
+
+		// A backwards linear scan finds the most recent match first; even at
+		// full context this is far cheaper than one decode step
+		for (size_t start = tail; start-- > 0;)
+		{
+			int k = 0;
+			while (k < n && at(start + k) == at(tail + k))
+				++k;
+			if (k < n)
+				continue;
+
+			for (size_t i = start + n; i < n_tokens && (int)draft.size() < n_draft; ++i)
+				draft.push_back(at(i));
+			return;
+		}
+	}
+}
@@ -0,0 +1,37 @@
+#include "llm/sampler_pool.h"
+
+SamplerPool::SamplerPool(int n_vocab)
+		: n_vocab_(n_vocab), n_created_(0)
+{
+}
+
+std::unique_ptr<FusedSampler> SamplerPool::acquire(const SamplingParams &params)
+{
+	auto found = idle_.find(params);
+	if (found == idle_.end())
+		found = idle_.begin();
+
+	if (found == idle_.end())
+	{
+		n_created_++;
+		return std::make_unique<FusedSampler>(n_vocab_, params);
+	}
+
+	std::unique_ptr<FusedSampler> sampler = std::move(found->second.back());
+	found->second.pop_back();
+	if (found->second.empty())
+		idle_.erase(found);
+
+	// Also clears the penalty history and restarts a fixed seed
+	sampler->configure(params);
+	return sampler;
+}
+
+void SamplerPool::release(std::unique_ptr<FusedSampler> sampler)
+{
+	if (!sampler)
+		return;
+
+	SamplingParams params = sampler->params();
+	idle_[params].push_back(std::move(sampler));
+}
@@ -0,0 +1,79 @@
+#include "llm/session_cache.h"
+
+static size_t entry_bytes(const SessionCache::Entry &entry)
+{
+	return entry.state.size() + entry.tokens.size() * sizeof(int);
+}
+
+SessionCache::SessionCache(size_t max_bytes)
+		: max_bytes_(max_bytes), bytes_(0), evictions_(0)
+{
+}
+
+void SessionCache::put(const std::string &id, Entry entry)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	auto found = index_.find(id);
+	if (found != index_.end())
+		erase(found->second);
+
+	size_t size = entry_bytes(entry);
+	if (size > max_bytes_)
+	{
+		// Would never fit; dropping it is an eviction as far as the
+		// session is concerned
+		evictions_++;
+		return;
+	}
+
+	lru_.emplace_front(id, std::move(entry));
+	index_[id] = lru_.begin();
+	bytes_ += size;
+
+	while (bytes_ > max_bytes_ && !lru_.empty())
+	{
+		erase(std::prev(lru_.end()));
+		evictions_++;
+	}
+}
+
+bool SessionCache::take(const std::string &id, Entry &out)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	auto found = index_.find(id);
+	if (found == index_.end())
+		return false;
+
+	out = std::move(found->second->second);
+	bytes_ -= entry_bytes(out);
+	lru_.erase(found->second);
+	index_.erase(found);
+	return true;
+}
+
+void SessionCache::erase(std::list<Item>::iterator it)
+{
+	bytes_ -= entry_bytes(it->second);
+	index_.erase(it->first);
+	lru_.erase(it);
+}
+
+size_t SessionCache::size() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return lru_.size();
+}
+
+size_t SessionCache::bytes() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return bytes_;
+}
+
+uint64_t SessionCache::evictions() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return evictions_;
+}
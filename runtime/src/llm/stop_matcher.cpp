@@ -0,0 +1,94 @@
+#include "llm/stop_matcher.h"
+#include <queue>
+
+StopMatcher::StopMatcher(const std::vector<std::string> &stops)
+{
+	// Trie of the stops; -1 marks a missing edge
+	next_.assign(256, -1);
+	depth_.push_back(0);
+	match_.push_back(0);
+
+	for (const auto &stop : stops)
+	{
+		int32_t state = 0;
+		for (unsigned char c : stop)
+		{
+			int32_t &edge = next_[state * 256 + c];
+			if (edge < 0)
+			{
+				edge = static_cast<int32_t>(depth_.size());
+				next_.resize(next_.size() + 256, -1);
+				depth_.push_back(depth_[state] + 1);
+				match_.push_back(0);
+			}
+			// resize() may have moved the table, so index again
+			state = next_[state * 256 + c];
+		}
+		if (!stop.empty())
+			match_[state] = depth_[state];
+	}
+
+	// Breadth-first, every state's failure state is done before it is
+	// needed: missing edges are taken from there, and so are matches of
+	// shorter stops that end inside a longer one
+	std::vector<int32_t> fail(depth_.size(), 0);
+	std::queue<int32_t> queue;
+
+	for (int c = 0; c < 256; ++c)
+	{
+		int32_t &edge = next_[c];
+		if (edge < 0)
+			edge = 0;
+		else
+			queue.push(edge);
+	}
+
+	while (!queue.empty())
+	{
+		int32_t state = queue.front();
+		queue.pop();
+
+		if (match_[state] == 0)
+			match_[state] = match_[fail[state]];
+
+		for (int c = 0; c < 256; ++c)
+		{
+			int32_t &edge = next_[state * 256 + c];
+			int32_t fallback = next_[fail[state] * 256 + c];
+			if (edge < 0)
+			{
+				edge = fallback;
+			}
+			else
+			{
+				fail[edge] = fallback;
+				queue.push(edge);
+			}
+		}
+	}
+}
+
+void StopMatcher::reset()
+{
+	state_ = 0;
+	consumed_ = 0;
+}
+
+size_t StopMatcher::feed(const char *data, size_t n)
+{
+	if (empty())
+	{
+		consumed_ += n;
+		return std::string::npos;
+	}
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		state_ = next_[state_ * 256 + static_cast<unsigned char>(data[i])];
+		if (match_[state_] != 0)
+			return consumed_ + i + 1 - match_[state_];
+	}
+
+	consumed_ += n;
+	return std::string::npos;
+}
@@ -1,8 +1,12 @@
+#include <algorithm>
 #include <iostream>
 #include <memory>
 #include <csignal>
 #include <getopt.h>
+#include "core/logger.h"
+#include "core/trace.h"
 #include "ipc/socket_server.h"
+#include "core/tool_executor.h"
 #include "core/tool_registry.h"
 #include "tools/list_dir_tool.h"
 #include "llm/llama_engine.h"
@@ -28,8 +32,22 @@ void print_usage(const char *prog)
 						<< "  -m, --model PATH       Path to GGUF model file (required)\n"
 						<< "  -c, --config PATH      Path to config JSON file\n"
 						<< "  -t, --threads N        Number of threads (default: 4)\n"
-						<< "  -C, --ctx-size N       Context size (default: 2048)\n"
+						<< "  -C, --ctx-size N       Context size per sequence (default: 2048)\n"
+						<< "  -p, --parallel N       Sequences decoded together (default: 1)\n"
+						<< "  -P, --contexts N       Contexts serving requests side by side (default: 1)\n"
+						<< "  -T, --context-threads N Threads per context (default: threads / contexts)\n"
+						<< "  -k, --cache-type TYPE  KV cache type: f16, q8_0, q4_0 (default: f16)\n"
+						<< "  -f, --flash-attn       Use flash attention\n"
+						<< "  -M, --memory-budget MB Fit context, parallel and KV type into this much RAM\n"
+						<< "  -N, --numa STRATEGY    NUMA placement: distribute, isolate, numactl (default: off)\n"
+						<< "  -A, --autotune         Measure the fastest threads and batch sizes at startup\n"
+						<< "  -d, --draft-model PATH Draft GGUF for speculative decoding\n"
 						<< "  -s, --socket PATH      Unix socket path (default: /tmp/forge-ai.sock)\n"
+						<< "  -w, --workers N        Worker threads for generate/infer (default: 4)\n"
+						<< "  -j, --tool-threads N   Threads running tool calls (default: cores left by --threads)\n"
+						<< "  -e, --metrics-file PATH Rewrite PATH with Prometheus metrics every 10 s\n"
+						<< "  -l, --log-level LEVEL  debug, info, warn, error or off (default: info)\n"
+						<< "  -L, --log-file PATH    Write the log to PATH instead of stderr\n"
 						<< "  -v, --verbose          Enable verbose logging\n"
 						<< "  -h, --help             Show this help\n\n"
 						<< "Example:\n"
@@ -46,6 +64,8 @@ int main(int argc, char **argv)
 
 	std::string socket_path = "/tmp/forge-ai.sock";
 	std::string config_file;
+	int n_workers = 4;
+	std::string metrics_file;
 	bool model_specified = false;
 
 	// Parse command line arguments
@@ -54,7 +74,21 @@ int main(int argc, char **argv)
 			{"config", required_argument, 0, 'c'},
 			{"threads", required_argument, 0, 't'},
 			{"ctx-size", required_argument, 0, 'C'},
+			{"parallel", required_argument, 0, 'p'},
+			{"contexts", required_argument, 0, 'P'},
+			{"context-threads", required_argument, 0, 'T'},
+			{"cache-type", required_argument, 0, 'k'},
+			{"flash-attn", no_argument, 0, 'f'},
+			{"memory-budget", required_argument, 0, 'M'},
+			{"numa", required_argument, 0, 'N'},
+			{"autotune", no_argument, 0, 'A'},
+			{"draft-model", required_argument, 0, 'd'},
 			{"socket", required_argument, 0, 's'},
+			{"workers", required_argument, 0, 'w'},
+			{"tool-threads", required_argument, 0, 'j'},
+			{"metrics-file", required_argument, 0, 'e'},
+			{"log-level", required_argument, 0, 'l'},
+			{"log-file", required_argument, 0, 'L'},
 			{"verbose", no_argument, 0, 'v'},
 			{"help", no_argument, 0, 'h'},
 			{0, 0, 0, 0}};
@@ -62,7 +96,7 @@ int main(int argc, char **argv)
 	int opt;
 	int option_index = 0;
 
-	while ((opt = getopt_long(argc, argv, "m:c:t:C:s:vh", long_options, &option_index)) != -1)
+	while ((opt = getopt_long(argc, argv, "m:c:t:C:p:P:T:k:fM:N:Ad:s:w:j:e:l:L:vh", long_options, &option_index)) != -1)
 	{
 		switch (opt)
 		{
@@ -79,9 +113,52 @@ int main(int argc, char **argv)
 		case 'C':
 			llm_config.n_ctx = std::atoi(optarg);
 			break;
+		case 'p':
+			llm_config.n_parallel = std::atoi(optarg);
+			break;
+		case 'P':
+			llm_config.n_contexts = std::atoi(optarg);
+			break;
+		case 'T':
+			llm_config.n_threads_per_context = std::atoi(optarg);
+			break;
+		case 'k':
+			llm_config.cache_type_k = optarg;
+			llm_config.cache_type_v = optarg;
+			break;
+		case 'f':
+			llm_config.flash_attn = true;
+			break;
+		case 'M':
+			llm_config.memory_budget_mb = std::atoi(optarg);
+			break;
+		case 'N':
+			llm_config.numa = optarg;
+			break;
+		case 'A':
+			llm_config.autotune = true;
+			break;
+		case 'd':
+			llm_config.draft_model_path = optarg;
+			break;
 		case 's':
 			socket_path = optarg;
 			break;
+		case 'w':
+			n_workers = std::atoi(optarg);
+			break;
+		case 'j':
+			llm_config.tool_threads = std::atoi(optarg);
+			break;
+		case 'e':
+			metrics_file = optarg;
+			break;
+		case 'l':
+			llm_config.log_level = optarg;
+			break;
+		case 'L':
+			llm_config.log_file = optarg;
+			break;
 		case 'v':
 			llm_config.verbose = true;
 			break;
@@ -109,6 +186,24 @@ int main(int argc, char **argv)
 		}
 	}
 
+	LogLevel log_level;
+	if (!parse_log_level(llm_config.log_level, log_level))
+	{
+		std::cerr << "[ERROR] Unknown log level: " << llm_config.log_level << " (use debug, info, warn, error or off)\n";
+		return 1;
+	}
+	if (llm_config.verbose)
+		log_level = LogLevel::DEBUG;
+
+	size_t body_bytes = static_cast<size_t>(std::max(0, llm_config.log_body_bytes));
+	if (!Logger::instance().configure(log_level, llm_config.log_file, llm_config.log_format == "json", body_bytes))
+	{
+		std::cerr << "[ERROR] Cannot open log file: " << llm_config.log_file << "\n";
+		return 1;
+	}
+
+	Tracer::instance().configure(llm_config.trace_dir, llm_config.trace_sample_rate);
+
 	// Check if model is specified
 	if (!model_specified && llm_config.model_path.empty())
 	{
@@ -123,9 +218,25 @@ int main(int argc, char **argv)
 
 	std::cout << "[Configuration]\n";
 	std::cout << "  Model:       " << llm_config.model_path << "\n";
-	std::cout << "  Threads:     " << llm_config.n_threads << "\n";
+	std::cout << "  Threads:     " << (llm_config.autotune ? "autotune" : std::to_string(llm_config.n_threads)) << "\n";
 	std::cout << "  Context:     " << llm_config.n_ctx << " tokens\n";
+	std::cout << "  Parallel:    " << llm_config.n_parallel << " sequence(s)\n";
+	if (llm_config.n_contexts > 1)
+		std::cout << "  Contexts:    " << llm_config.n_contexts << "\n";
+	std::cout << "  KV cache:    " << llm_config.cache_type_k << "/" << llm_config.cache_type_v
+						<< (llm_config.flash_attn ? ", flash attention" : "") << "\n";
+	if (llm_config.memory_budget_mb > 0)
+		std::cout << "  Memory:      " << llm_config.memory_budget_mb << " MiB budget\n";
+	if (llm_config.numa != "disabled")
+		std::cout << "  NUMA:        " << llm_config.numa << "\n";
+	if (!llm_config.draft_model_path.empty())
+		std::cout << "  Draft model: " << llm_config.draft_model_path << "\n";
 	std::cout << "  Socket:      " << socket_path << "\n";
+	std::cout << "  Workers:     " << n_workers << "\n";
+	if (!metrics_file.empty())
+		std::cout << "  Metrics:     " << metrics_file << "\n";
+	std::cout << "  Log:         " << (llm_config.verbose ? "debug" : llm_config.log_level) << " to "
+						<< (llm_config.log_file.empty() ? "stderr" : llm_config.log_file) << "\n";
 	std::cout << "  Verbose:     " << (llm_config.verbose ? "yes" : "no") << "\n\n";
 
 	// Setup signal handlers
@@ -157,12 +268,28 @@ int main(int argc, char **argv)
 
 		std::cout << "  ✓ Registered " << registry.list().size() << " tool(s)\n\n";
 
-		// 3. Create dispatcher
+		// 3. Create dispatcher, with the pool its tool calls run on
 		std::cout << "[4/4] Starting IPC server...\n";
-		ActionDispatcher dispatcher(registry, llm_engine);
+		ToolExecutor::Limit tool_defaults{llm_config.tool_max_concurrent, std::chrono::milliseconds(llm_config.tool_timeout_ms)};
+		size_t n_tool_threads = llm_config.tool_threads > 0
+																? static_cast<size_t>(llm_config.tool_threads)
+																: ToolExecutor::default_threads(llm_engine->decode_threads());
+		ToolExecutor tool_executor(n_tool_threads, tool_defaults);
+		for (const auto &[tool, limit] : llm_config.tool_limits)
+			tool_executor.set_limit(tool, {limit.max_concurrent, std::chrono::milliseconds(limit.timeout_ms)});
+		std::cout << "  ✓ " << n_tool_threads << " tool thread(s)\n";
+
+		ActionDispatcher dispatcher(registry, llm_engine, tool_executor);
+
+		// Load (or build and save) the shared prompt prefix before the
+		// first request can arrive
+		dispatcher.warm_up();
+
+		if (!metrics_file.empty())
+			dispatcher.start_metrics_dump(metrics_file);
 
 		// 4. Start server
-		SocketServer server(socket_path, dispatcher);
+		SocketServer server(socket_path, dispatcher, n_workers);
 		g_server = &server;
 
 		std::cout << "\n╔════════════════════════════════════════╗\n";